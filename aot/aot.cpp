@@ -0,0 +1,427 @@
+#include "Analysis.h"
+#include "Aot.h"
+#include "Batch.h"
+#include "Replay.h"
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+// Ahead-of-time compiler: analyses a rom, writes C++ for every reachable
+// run of instructions it can handle and builds that into a shared library
+// the emulator loads with --aot. Key input, stores to memory, the sound
+// timer and anything the analysis couldn't reach stay with the interpreter.
+
+#ifndef AOT_CXX
+#define AOT_CXX "g++"
+#endif
+
+#ifndef AOT_INCLUDE
+#define AOT_INCLUDE "include"
+#endif
+
+struct Options {
+    const char* rom = nullptr;
+    const char* out = "aot";
+    const char* cxx = AOT_CXX;
+    Platform platform = VIP;
+    bool emit_only = false;
+};
+
+// the quirks the generated code is specialised for, see Quirks.h
+struct Flags {
+    bool vf_reset;
+    bool shift_vx;
+    bool memory_increment;
+    bool clip;
+    bool jump_vx;
+};
+
+template <class Q>
+static Flags flags_of() {
+    return { Q::vf_reset, Q::shift_vx, Q::memory_increment, Q::clip, Q::jump_vx };
+}
+
+// a straight run of instructions compiled as one piece of code
+struct Unit {
+    uint16_t start;
+    uint16_t end;
+};
+
+class Generator {
+private:
+    const std::vector<uint8_t>& rom;
+    const Analysis& analysis;
+    Flags flags;
+    std::vector<Unit> units;
+
+    // unit starting at every address, -1 if none
+    std::vector<int> unit_at;
+
+    uint16_t instr_at(uint16_t addr) const {
+        return rom[addr - 0x200] << 8 | rom[addr - 0x200 + 1];
+    }
+
+    // instructions the generated code runs itself
+    static bool supported(uint16_t instr) {
+        switch (instr >> 12) {
+        case 0x0: return instr == 0x00E0 || instr == 0x00EE;
+        case 0x5:
+        case 0x9: return (instr & 0xF) == 0;
+        case 0x8: return (instr & 0xF) <= 0x7 || (instr & 0xF) == 0xE;
+        case 0xE: return false;
+        case 0xF:
+            switch (instr & 0xFF) {
+            case 0x07:
+            case 0x15:
+            case 0x1E:
+            case 0x29:
+            case 0x65: return true;
+            }
+            return false;
+        }
+        return true;
+    }
+
+    // the longest supported prefix of every block, skipping any that would
+    // overlap another (misaligned code)
+    void build_units() {
+        std::vector<bool> taken(4096, false);
+        unit_at.assign(4096, -1);
+
+        for (const Analysis::Block& block : analysis.blocks) {
+            uint16_t end = block.start;
+            while (end < block.end && end + 1u < 0x200 + rom.size() && supported(instr_at(end))) {
+                end += 2;
+            }
+            if (end == block.start) {
+                continue;
+            }
+
+            bool overlaps = false;
+            for (uint16_t a = block.start; a < end; a++) {
+                overlaps |= taken[a];
+            }
+            if (overlaps) {
+                continue;
+            }
+
+            for (uint16_t a = block.start; a < end; a++) {
+                taken[a] = true;
+            }
+            unit_at[block.start] = units.size();
+            units.push_back({ block.start, end });
+        }
+    }
+
+    // continue at a known address: straight into its unit, else back to
+    // the caller with pc set
+    std::string go(uint16_t target) const {
+        std::ostringstream s;
+        s << "pc = 0x" << std::hex << target << "; ";
+        if (target < 4096 && unit_at[target] >= 0) {
+            s << "goto u" << std::dec << unit_at[target] << ";";
+        } else {
+            s << "goto leave;";
+        }
+        return s.str();
+    }
+
+    // leave without running the instruction at addr
+    static std::string bail(uint16_t addr) {
+        std::ostringstream s;
+        s << "{ pc = 0x" << std::hex << addr << "; n--; goto leave; }";
+        return s.str();
+    }
+
+    // code for one instruction; the same steps in the same order as the
+    // instruction functions in Chip8.cpp, so corner cases (VF as an operand,
+    // I past the end of memory) come out identical
+    void emit_instr(std::ostream& out, uint16_t addr) const {
+        uint16_t instr = instr_at(addr);
+        uint16_t nnn = instr & 0xFFF;
+        int x = (instr >> 8) & 0xF;
+        int y = (instr >> 4) & 0xF;
+        int n = instr & 0xF;
+        int nn = instr & 0xFF;
+        uint16_t next = addr + 2;
+        int src = flags.shift_vx ? x : y;
+
+        // every instruction is a place a run can stop and resume at
+        out << "a" << std::hex << addr << ": // " << Analysis::disassemble(instr) << std::dec << "\n";
+        out << "    if (n == budget) { pc = 0x" << std::hex << addr << std::dec << "; goto leave; }\n";
+        out << "    n++;\n    ";
+        switch (instr >> 12) {
+        case 0x0:
+            if (instr == 0x00E0) {
+                out << "s->frame.clear(); effects++;";
+            } else {
+                out << "if (s->sp == 0) " << bail(addr) << "\n";
+                out << "    s->sp--; pc = s->stack[s->sp]; effects++; goto dispatch;";
+            }
+            break;
+        case 0x1:
+            // jumping back is how every busy-wait loop closes, let the
+            // caller look for one
+            if (nnn < next) {
+                out << "pc = 0x" << std::hex << nnn << std::dec << "; loops = true; goto leave;";
+            } else {
+                out << go(nnn);
+            }
+            break;
+        case 0x2:
+            out << "if (s->sp >= 16) " << bail(addr) << "\n";
+            out << "    s->stack[s->sp] = 0x" << std::hex << next << std::dec << "; s->sp++; effects++; " << go(nnn);
+            break;
+        case 0x3:
+            out << "if (V[" << x << "] == " << nn << ") { " << go(next + 2) << " } " << go(next);
+            break;
+        case 0x4:
+            out << "if (V[" << x << "] != " << nn << ") { " << go(next + 2) << " } " << go(next);
+            break;
+        case 0x5:
+            out << "if (V[" << x << "] == V[" << y << "]) { " << go(next + 2) << " } " << go(next);
+            break;
+        case 0x9:
+            out << "if (V[" << x << "] != V[" << y << "]) { " << go(next + 2) << " } " << go(next);
+            break;
+        case 0x6:
+            out << "V[" << x << "] = " << nn << ";";
+            break;
+        case 0x7:
+            out << "V[" << x << "] += " << nn << ";";
+            break;
+        case 0x8:
+            emit_alu(out, n, x, y, src);
+            break;
+        case 0xA:
+            out << "I = 0x" << std::hex << nnn << std::dec << ";";
+            break;
+        case 0xB:
+            out << "pc = 0x" << std::hex << nnn << std::dec << " + V[" << (flags.jump_vx ? (nnn >> 8) & 0xF : 0) << "]; goto dispatch;";
+            break;
+        case 0xC:
+            out << "V[" << x << "] = random_byte(s->rng_state) & " << nn << ";";
+            break;
+        case 0xD:
+            out << "effects++; V[15] = 0; if (draw(s, V[" << x << "] % 64, V[" << y << "] % 32, I, " << n << ")) V[15] = 1;";
+            break;
+        case 0xF:
+            switch (nn) {
+            case 0x07: out << "V[" << x << "] = s->reg_t;"; break;
+            case 0x15: out << "s->reg_t = V[" << x << "];"; break;
+            case 0x1E: out << "I += V[" << x << "];"; break;
+            case 0x29: out << "I = 5 * V[" << x << "];"; break;
+            case 0x65:
+                out << "{ uint16_t start = I; for (int i = 0; i <= " << x << "; i++) { V[i] = s->memory[I & 0xFFF]; I++; }";
+                out << (flags.memory_increment ? " (void)start; }" : " I = start; }");
+                break;
+            }
+            break;
+        }
+        out << "\n";
+    }
+
+    void emit_alu(std::ostream& out, int op, int x, int y, int src) const {
+        // VF keeps the flag when it is also the destination
+        auto store = [x](const std::string& value) {
+            return x != 0xF ? "V[" + std::to_string(x) + "] = " + value + ";" : std::string();
+        };
+        std::string vx = "V[" + std::to_string(x) + "]";
+        std::string vy = "V[" + std::to_string(y) + "]";
+        std::string reset = flags.vf_reset ? " V[15] = 0;" : "";
+
+        switch (op) {
+        case 0x0: out << vx << " = " << vy << ";"; break;
+        case 0x1: out << vx << " |= " << vy << ";" << reset; break;
+        case 0x2: out << vx << " &= " << vy << ";" << reset; break;
+        case 0x3: out << vx << " ^= " << vy << ";" << reset; break;
+        case 0x4:
+            out << "{ uint16_t sum = " << vx << " + " << vy << "; V[15] = sum > 0xFF; " << store("uint8_t(sum)") << " }";
+            break;
+        case 0x5:
+            out << "{ uint8_t diff = " << vx << " - " << vy << "; V[15] = " << vx << " >= " << vy << "; " << store("diff") << " }";
+            break;
+        case 0x6:
+            out << "V[15] = V[" << src << "] & 1; " << store("V[" + std::to_string(src) + "] >> 1");
+            break;
+        case 0x7:
+            out << "{ uint8_t diff = " << vy << " - " << vx << "; V[15] = " << vx << " <= " << vy << "; " << store("diff") << " }";
+            break;
+        case 0xE:
+            out << "V[15] = (V[" << src << "] >> 7) & 1; " << store("uint8_t(V[" + std::to_string(src) + "] << 1)");
+            break;
+        }
+    }
+
+    void emit_unit(std::ostream& out, size_t index) const {
+        const Unit& unit = units[index];
+
+        // only entered while its bytes are as compiled
+        out << "u" << index << ":\n";
+        out << "    if (dead[" << index << "]) goto leave;\n";
+
+        uint16_t last = 0;
+        for (uint16_t addr = unit.start; addr < unit.end; addr += 2) {
+            emit_instr(out, addr);
+            last = instr_at(addr);
+        }
+
+        // ran into a leader or an instruction left to the interpreter
+        switch (last >> 12) {
+        case 0x1: case 0x2: case 0x3: case 0x4: case 0x5: case 0x9: case 0xB:
+            break;
+        default:
+            if (last != 0x00EE) {
+                out << "    " << go(unit.end) << "\n";
+            }
+        }
+        out << "\n";
+    }
+
+public:
+    Generator(const std::vector<uint8_t>& rom, const Analysis& analysis, Flags flags)
+        : rom(rom), analysis(analysis), flags(flags) {
+        build_units();
+    }
+
+    size_t unit_count() const {
+        return units.size();
+    }
+
+    void emit(std::ostream& out, const char* name, uint64_t hash, Platform platform) const {
+        out << "// generated by chip8-aot from " << name << ", do not edit\n";
+        out << "#include <cstring>\n#include \"Aot.h\"\n#include \"Random.h\"\n\n";
+
+        out << "static const uint8_t image[" << rom.size() << "] = {";
+        for (size_t i = 0; i < rom.size(); i++) {
+            out << (i % 16 == 0 ? "\n    " : " ") << int(rom[i]) << ",";
+        }
+        out << "\n};\n\n";
+
+        // empty arrays aren't allowed, keep one unused entry
+        out << "static const uint16_t unit_start[] = {";
+        for (const Unit& u : units) {
+            out << " " << u.start << ",";
+        }
+        out << " 0 };\nstatic const uint16_t unit_end[] = {";
+        for (const Unit& u : units) {
+            out << " " << u.end << ",";
+        }
+        out << " 0 };\n\n";
+
+        out << "// DXYN after VF is cleared, the same as Chip8::drwD\n";
+        out << "static inline bool draw(State* s, uint8_t x0, uint8_t y0, uint16_t I, int rows) {\n";
+        out << "    bool collision = false;\n";
+        out << "    for (int i = 0; i < rows; i++) {\n";
+        out << "        uint8_t y = y0 + i;\n";
+        if (flags.clip) {
+            out << "        if (y > 31) {\n            break;\n        }\n";
+            out << "        collision |= s->frame.draw_row(x0, y, s->memory[(I + i) & 0xFFF]);\n";
+        } else {
+            out << "        collision |= s->frame.draw_row_wrapped(x0, y % 32, s->memory[(I + i) & 0xFFF]);\n";
+        }
+        out << "    }\n    return collision;\n}\n\n";
+
+        out << "static int run(State* s, const uint8_t* dead, int budget, Aot_Result* result) {\n";
+        out << "    uint8_t V[16];\n    memcpy(V, s->reg_v, sizeof(V));\n";
+        out << "    uint16_t I = s->reg_i;\n    uint16_t pc = s->pc;\n";
+        out << "    int n = 0;\n    uint32_t effects = 0;\n    bool loops = false;\n\n";
+
+        out << "dispatch:\n    switch (pc) {\n";
+        for (size_t i = 0; i < units.size(); i++) {
+            out << "    case 0x" << std::hex << units[i].start << std::dec << ": goto u" << i << ";\n";
+            for (uint16_t addr = units[i].start + 2; addr < units[i].end; addr += 2) {
+                out << "    case 0x" << std::hex << addr << ": if (dead[" << std::dec << i << "]) goto leave; goto a" << std::hex << addr << std::dec << ";\n";
+            }
+        }
+        out << "    default: goto leave;\n    }\n\n";
+
+        for (size_t i = 0; i < units.size(); i++) {
+            emit_unit(out, i);
+        }
+
+        out << "leave:\n";
+        out << "    memcpy(s->reg_v, V, sizeof(V));\n    s->reg_i = I;\n    s->pc = pc;\n";
+        out << "    result->effects = effects;\n    result->loops = loops;\n    return n;\n}\n\n";
+
+        out << "static const Aot_Module module = {\n";
+        out << "    AOT_ABI, sizeof(State), 0x" << std::hex << hash << std::dec << "ull, " << platform << ",\n";
+        out << "    image, " << rom.size() << ", " << units.size() << ", unit_start, unit_end, run\n};\n\n";
+        out << "extern \"C\" const Aot_Module* chip8_aot_module() {\n    return &module;\n}\n";
+    }
+};
+
+int main(int argc, char* argv[]) {
+    Options opt;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            opt.out = argv[++i];
+        } else if (strcmp(argv[i], "--cxx") == 0 && i + 1 < argc) {
+            opt.cxx = argv[++i];
+        } else if (strcmp(argv[i], "--emit-only") == 0) {
+            opt.emit_only = true;
+        } else if (strcmp(argv[i], "--platform") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "schip") == 0) {
+                opt.platform = SUPER_CHIP;
+            } else if (strcmp(argv[i], "modern") == 0) {
+                opt.platform = MODERN;
+            } else {
+                opt.platform = VIP;
+            }
+        } else if (opt.rom == nullptr) {
+            opt.rom = argv[i];
+        } else {
+            opt.rom = nullptr;
+            break;
+        }
+    }
+
+    if (opt.rom == nullptr) {
+        std::cout << "Usage: chip8-aot [--platform vip|schip|modern] [--out DIR] [--cxx COMPILER] [--emit-only] <rom>" << std::endl;
+        return 1;
+    }
+
+    std::vector<uint8_t> rom = Batch::load(opt.rom);
+    uint64_t hash = InputLog::hash_file(opt.rom);
+    Analysis analysis(rom);
+
+    Flags flags;
+    switch (opt.platform) {
+    case VIP: flags = flags_of<Vip>(); break;
+    case SUPER_CHIP: flags = flags_of<SuperChip>(); break;
+    default: flags = flags_of<Modern>(); break;
+    }
+    Generator generator(rom, analysis, flags);
+
+    std::string so = std::string(opt.out) + "/" + Aot::file_name(hash, opt.platform);
+    std::string cpp = so.substr(0, so.size() - 3) + ".cpp";
+    mkdir(opt.out, 0755);
+
+    std::ofstream file(cpp);
+    generator.emit(file, opt.rom, hash, opt.platform);
+    file.close();
+    if (!file) {
+        std::cerr << "Error: Failed to write file " << cpp << "\n";
+        return 1;
+    }
+    std::cout << cpp << ": " << generator.unit_count() << " units from " << analysis.blocks.size() << " blocks\n";
+
+    if (opt.emit_only) {
+        return 0;
+    }
+
+    std::string command = std::string(opt.cxx) + " -O2 -std=c++17 -shared -fPIC -I'" AOT_INCLUDE "' '" + cpp + "' -o '" + so + "'";
+    if (std::system(command.c_str()) != 0) {
+        std::cerr << "Error: " << command << " failed\n";
+        return 1;
+    }
+    std::cout << so << std::endl;
+    return 0;
+}
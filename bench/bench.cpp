@@ -0,0 +1,361 @@
+#include "Aot.h"
+#include "Chip8.h"
+#include "Headless.h"
+#include "Lockstep.h"
+#include "Replay.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Micro-benchmarks for the core: each generated rom loops forever over one
+// kind of work, and each engine runs it for a fixed instruction budget a few
+// times over. Results go to stdout as a table and optionally to a csv file
+// that is appended to, so runs from different commits can be compared.
+// The AOT engine needs each rom compiled by chip8-aot first: --roms writes
+// the roms out for it and --aot points at the libraries it built. Before
+// anything is timed, every engine and the lockstep engine are checked
+// against the interpreter frame by frame, and a mismatch fails the run.
+
+// frames each rom is checked for
+#define VERIFY_FRAMES 600
+
+struct Options {
+    uint64_t cycles = 2000000;
+    int reps = 7;
+    int ipf = 16;
+    const char* csv = nullptr;
+    const char* label = "";
+    const char* only = nullptr;
+    const char* roms = nullptr;
+    const char* aot = nullptr;
+};
+
+// -- Roms
+
+// a rom image being assembled, addresses are absolute (0x200 and up)
+struct Rom {
+    std::string name;
+    std::vector<uint8_t> bytes;
+
+    void put(uint16_t addr, std::initializer_list<uint16_t> ops) {
+        for (uint16_t op : ops) {
+            size_t at = addr - 0x200;
+            if (bytes.size() < at + 2) {
+                bytes.resize(at + 2);
+            }
+            bytes[at] = op >> 8;
+            bytes[at + 1] = op & 0xFF;
+            addr += 2;
+        }
+    }
+};
+
+// every 8XY_ operation back to back
+static Rom alu_rom() {
+    Rom rom = { "alu", {} };
+    rom.put(0x200, { 0x6107, 0x6203, 0x6355 });
+    rom.put(0x206, { 0x8011, 0x8022, 0x8033, 0x8014, 0x8025, 0x8036, 0x8017, 0x801E, 0x8120, 0x8234, 0x1206 });
+    return rom;
+}
+
+// skips taken and not taken, each over a throwaway add
+static Rom branch_rom() {
+    Rom rom = { "branch", {} };
+    rom.put(0x200, {
+        0x7001,
+        0x3080, 0x7203,
+        0x4000, 0x7203,
+        0x5010, 0x7203,
+        0x9010, 0x7203,
+        0x1200
+    });
+    return rom;
+}
+
+// DXYN of the given height walking across the screen, clip moves it to the
+// bottom edge so most rows fall off
+static Rom draw_rom(int height, bool clip) {
+    Rom rom = { "draw" + std::to_string(height) + (clip ? "_clip" : ""), {} };
+    rom.put(0x200, { 0x6000, uint16_t(clip ? 0x611C : 0x6100), 0xA000 });
+    rom.put(0x206, { uint16_t(0xD010 | height), 0x7007, 0x1206 });
+    return rom;
+}
+
+// FX55 / FX65 of all sixteen registers
+static Rom copy_rom() {
+    Rom rom = { "copy", {} };
+    rom.put(0x200, { 0xAE00, 0xFF55, 0xAE00, 0xFF65, 0x1200 });
+    return rom;
+}
+
+// call/ret nested depth levels deep
+static Rom call_rom(int depth) {
+    Rom rom = { "call" + std::to_string(depth), {} };
+    rom.put(0x200, { 0x2210, 0x1200 });
+    for (int i = 0; i < depth; i++) {
+        uint16_t addr = 0x210 + 0x10 * i;
+        if (i + 1 < depth) {
+            rom.put(addr, { uint16_t(0x2000 | (addr + 0x10)), 0x00EE });
+        } else {
+            rom.put(addr, { 0x00EE });
+        }
+    }
+    return rom;
+}
+
+// a timer set and read again twenty instructions later, each straight
+// through: at 16 instructions a frame a boundary falls in between, which
+// has to tick the timer between the two
+static Rom timer_rom() {
+    Rom rom = { "timer", {} };
+    rom.put(0x200, { 0x6005 });
+    for (int i = 0; i < 19; i++) {
+        rom.put(0x202 + 2 * i, { 0x6200 });
+    }
+    rom.put(0x228, { 0xF015 });
+    for (int i = 0; i < 19; i++) {
+        rom.put(0x22A + 2 * i, { 0x6200 });
+    }
+    rom.put(0x250, { 0xF107, 0x1200 });
+    return rom;
+}
+
+// -- Verification
+
+// run rom on engine and the interpreter side by side, false at the first
+// frame their states differ
+static bool verify(const Rom& rom, Chip8::Engine engine, const char* name, const Aot* code, const Options& opt) {
+    Headless ref_host = Headless();
+    Headless host = Headless();
+    Chip8 ref(ref_host, rom.bytes.data(), rom.bytes.size());
+    Chip8 chip(host, rom.bytes.data(), rom.bytes.size());
+    ref.set_ipf(opt.ipf);
+    chip.set_ipf(opt.ipf);
+    if (engine == Chip8::AOT) {
+        chip.attach(code);
+    }
+
+    for (int f = 0; f < VERIFY_FRAMES; f++) {
+        ref.run_frame(Chip8::INTERPRETER);
+        chip.run_frame(engine);
+        if (!chip.same_state(ref)) {
+            std::cerr << "Error: " << rom.name << " on " << name << " differs from the interpreter at frame " << f << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+// the same for every lane of the lockstep engine, each seeded differently
+static bool verify_lockstep(const Rom& rom, const Options& opt) {
+    const int lanes = 8;
+    Headless host;
+    std::unique_ptr<Lockstep<lanes>> engine(new Lockstep<lanes>(host, rom.bytes, opt.ipf));
+    std::vector<std::unique_ptr<Headless>> hosts;
+    std::vector<std::unique_ptr<Chip8>> refs;
+    for (int l = 0; l < lanes; l++) {
+        engine->seed(l, l);
+        hosts.emplace_back(new Headless());
+        refs.emplace_back(new Chip8(*hosts[l], rom.bytes.data(), rom.bytes.size()));
+        refs[l]->set_ipf(opt.ipf);
+        refs[l]->set_idle_skip(false);
+        refs[l]->seed(l);
+    }
+
+    for (int f = 0; f < VERIFY_FRAMES; f++) {
+        engine->run(opt.ipf);
+        for (int l = 0; l < lanes; l++) {
+            refs[l]->run_frame(Chip8::INTERPRETER);
+            Chip8::Registers a = engine->registers(l);
+            Chip8::Registers b = refs[l]->registers();
+            bool same = a.pc == b.pc && a.reg_i == b.reg_i && a.sp == b.sp && a.reg_t == b.reg_t &&
+                a.reg_s == b.reg_s && memcmp(a.reg_v, b.reg_v, sizeof(a.reg_v)) == 0 &&
+                memcmp(engine->framebuffer(l).rows, refs[l]->framebuffer().rows, sizeof(Framebuffer::rows)) == 0;
+            if (!same) {
+                std::cerr << "Error: " << rom.name << " on lockstep lane " << l << " differs from the interpreter at frame " << f << "\n";
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// -- Measurement
+
+struct Result {
+    double median;
+    double min;
+    double max;
+    double stddev;
+};
+
+// instructions per second for one rom on one engine, over opt.reps runs
+static Result measure(const Rom& rom, Chip8::Engine engine, const Aot* code, const Options& opt) {
+    std::vector<double> ips;
+
+    // the first run warms caches and the recompiler and isn't counted
+    for (int rep = -1; rep < opt.reps; rep++) {
+        Headless host = Headless();
+        Chip8 chip(host, rom.bytes.data(), rom.bytes.size());
+        chip.set_ipf(opt.ipf);
+        chip.set_idle_skip(false);
+        if (engine == Chip8::AOT) {
+            chip.attach(code);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        uint64_t executed = 0;
+        while (executed < opt.cycles) {
+            switch (engine) {
+            case Chip8::INTERPRETER: executed += chip.run(); break;
+            case Chip8::CACHED: executed += chip.run_cached(); break;
+            case Chip8::JIT: executed += chip.run_jit(); break;
+            case Chip8::THREADED: executed += chip.run_threaded(); break;
+            case Chip8::AOT: executed += chip.run_aot(); break;
+            }
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        if (rep >= 0) {
+            ips.push_back(executed / elapsed.count());
+        }
+    }
+
+    std::sort(ips.begin(), ips.end());
+    Result r;
+    r.median = ips[ips.size() / 2];
+    r.min = ips.front();
+    r.max = ips.back();
+
+    double mean = 0;
+    for (double v : ips) {
+        mean += v / ips.size();
+    }
+    double var = 0;
+    for (double v : ips) {
+        var += (v - mean) * (v - mean) / ips.size();
+    }
+    r.stddev = std::sqrt(var);
+    return r;
+}
+
+int main(int argc, char* argv[]) {
+    Options opt;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--cycles") == 0 && i + 1 < argc) {
+            opt.cycles = strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--reps") == 0 && i + 1 < argc) {
+            opt.reps = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--ipf") == 0 && i + 1 < argc) {
+            opt.ipf = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc) {
+            opt.csv = argv[++i];
+        } else if (strcmp(argv[i], "--label") == 0 && i + 1 < argc) {
+            opt.label = argv[++i];
+        } else if (strcmp(argv[i], "--only") == 0 && i + 1 < argc) {
+            opt.only = argv[++i];
+        } else if (strcmp(argv[i], "--roms") == 0 && i + 1 < argc) {
+            opt.roms = argv[++i];
+        } else if (strcmp(argv[i], "--aot") == 0 && i + 1 < argc) {
+            opt.aot = argv[++i];
+        } else {
+            std::cout << "Usage: chip8-bench [--cycles N] [--reps N] [--ipf N] [--only ROM] [--csv FILE] [--label TEXT] [--roms DIR | --aot DIR]" << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<Rom> roms = {
+        alu_rom(), branch_rom(),
+        draw_rom(1, false), draw_rom(5, false), draw_rom(15, false), draw_rom(15, true),
+        copy_rom(), call_rom(1), call_rom(8), timer_rom()
+    };
+
+    // write every rom as DIR/<name>.ch8 for chip8-aot and stop
+    if (opt.roms != nullptr) {
+        for (const Rom& rom : roms) {
+            std::string fpath = std::string(opt.roms) + "/" + rom.name + ".ch8";
+            std::ofstream file(fpath, std::ios::binary);
+            file.write(reinterpret_cast<const char*>(rom.bytes.data()), rom.bytes.size());
+            if (!file) {
+                std::cerr << "Error: Failed to write file " << fpath << "\n";
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    const Chip8::Engine engines[] = { Chip8::INTERPRETER, Chip8::CACHED, Chip8::THREADED, Chip8::JIT, Chip8::AOT };
+    const char* engine_names[] = { "interpreter", "cached", "threaded", "jit", "aot" };
+    const int engine_count = sizeof(engines) / sizeof(engines[0]);
+
+    // append, writing the header only into a new file
+    std::ofstream csv;
+    if (opt.csv != nullptr) {
+        bool fresh = !std::ifstream(opt.csv).good();
+        csv.open(opt.csv, std::ios::app);
+        if (!csv) {
+            std::cerr << "Error: Failed to open file " << opt.csv << "\n";
+            return 1;
+        }
+        if (fresh) {
+            csv << "label,rom,engine,cycles,reps,ips_median,ips_min,ips_max,ips_stddev,ns_per_op,fps\n";
+        }
+    }
+
+    std::cout << std::left << std::setw(12) << "rom" << std::setw(13) << "engine" << std::right;
+    std::cout << std::setw(14) << "ips" << std::setw(9) << "+-%" << std::setw(10) << "ns/op" << std::setw(14) << "fps" << "\n";
+
+    for (const Rom& rom : roms) {
+        if (opt.only != nullptr && rom.name != opt.only) {
+            continue;
+        }
+
+        // without a library the AOT engine is just the cache again
+        std::unique_ptr<Aot> code;
+        if (opt.aot != nullptr) {
+            uint64_t hash = InputLog::hash_rom(rom.bytes.data(), rom.bytes.size());
+            code.reset(new Aot((std::string(opt.aot) + "/" + Aot::file_name(hash, VIP)).c_str(), hash, VIP));
+        }
+
+        bool aot = code != nullptr && code->available();
+        for (int e = 1; e < engine_count; e++) {
+            if ((engines[e] != Chip8::AOT || aot) && !verify(rom, engines[e], engine_names[e], code.get(), opt)) {
+                return 1;
+            }
+        }
+        if (!verify_lockstep(rom, opt)) {
+            return 1;
+        }
+
+        for (int e = 0; e < engine_count; e++) {
+            if (engines[e] == Chip8::AOT && !aot) {
+                continue;
+            }
+            Result r = measure(rom, engines[e], code.get(), opt);
+            double ns = 1e9 / r.median;
+            double fps = r.median / opt.ipf;
+
+            std::cout << std::left << std::setw(12) << rom.name << std::setw(13) << engine_names[e] << std::right;
+            std::cout << std::fixed << std::setprecision(0) << std::setw(14) << r.median;
+            std::cout << std::setprecision(1) << std::setw(9) << 100 * r.stddev / r.median;
+            std::cout << std::setprecision(2) << std::setw(10) << ns;
+            std::cout << std::setprecision(0) << std::setw(14) << fps << std::endl;
+
+            if (csv.is_open()) {
+                csv << opt.label << "," << rom.name << "," << engine_names[e] << "," << opt.cycles << "," << opt.reps;
+                csv << std::fixed << std::setprecision(0) << "," << r.median << "," << r.min << "," << r.max << "," << r.stddev;
+                csv << std::setprecision(3) << "," << ns << std::setprecision(0) << "," << fps << "\n";
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Static analysis of a rom as loaded at 0x200. Code is found by recursive
+// descent from the entry point following jumps, calls, returns and skips;
+// the reachable instructions are cut into basic blocks and grouped into a
+// call graph. Bytes that sprite draws and FX65 read through a known I are
+// marked as data, stores through a known I that land on code are reported
+// as self-modifying, and BNNN jumps are reported as unresolved.
+class Analysis {
+public:
+    // per byte of memory
+    enum Flag : uint8_t {
+        CODE = 0x01,    // an instruction starts here
+        OPERAND = 0x02, // second byte of an instruction
+        LEADER = 0x04,  // a basic block starts here
+        ENTRY = 0x08,   // the entry point or a call target
+        DATA = 0x10,    // read by DXYN or FX65
+        WRITTEN = 0x20  // written by FX33 or FX55
+    };
+
+    struct Block {
+        uint16_t start;
+        // one past the last instruction
+        uint16_t end;
+        // blocks control can continue to, not counting a call's target
+        std::vector<uint16_t> next;
+        // target of the 2NNN ending the block, 0 if none
+        uint16_t call = 0;
+        bool returns = false;
+        // ends in BNNN, successors unknown
+        bool indirect = false;
+        // runs past the end of the rom
+        bool falls_off = false;
+    };
+
+    uint8_t flags[4096] = { 0 };
+
+    // sorted by start
+    std::vector<Block> blocks;
+
+    // function entry -> functions it calls
+    std::map<uint16_t, std::vector<uint16_t>> calls;
+
+    // addresses of BNNN instructions
+    std::vector<uint16_t> indirect_jumps;
+
+    // FX33/FX55 writing over code, and stores whose I couldn't be resolved
+    std::vector<uint16_t> self_modifying;
+    std::vector<uint16_t> unresolved_stores;
+
+private:
+    uint8_t memory[4096] = { 0 };
+    uint16_t rom_end;
+
+    uint16_t instr_at(uint16_t addr) const;
+
+    // mark the reachable instructions and block leaders
+    void explore();
+
+    // cut the marked code into blocks
+    void build_blocks();
+
+    // find I at every block entry, then mark data and stores
+    void track_i();
+
+    // group blocks into functions
+    void build_calls();
+
+public:
+// -- Ctor/dtor
+    Analysis(const std::vector<uint8_t>& rom);
+    ~Analysis();
+
+// -- Functions
+    // the block starting at addr, nullptr if none
+    const Block* block_at(uint16_t addr) const;
+
+    // disassembly with block boundaries, successors and data
+    void print(std::ostream& out) const;
+
+    // mnemonic for one instruction, e.g. "DRW V0, V1, 5"
+    static std::string disassemble(uint16_t instr);
+};
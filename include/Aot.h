@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include "Quirks.h"
+#include "State.h"
+
+// bumped whenever Aot_Module or the generated code's view of State changes
+#define AOT_ABI 2
+
+// what a compiled run did besides moving the registers
+struct Aot_Result {
+    // draws, clears, calls and returns, for idle detection
+    uint32_t effects;
+    // stopped on a jump backwards, a possible idle loop
+    bool loops;
+};
+
+// What chip8-aot compiles a rom into. The rom is cut into units, straight
+// runs of instructions the generated code handles; a unit is only entered
+// while the rom bytes it was built from are unchanged.
+struct Aot_Module {
+    uint32_t abi;
+    uint32_t state_size;
+    uint64_t rom_hash;
+    uint32_t platform;
+
+    // the rom as compiled, loaded at 0x200
+    const uint8_t* image;
+    uint16_t image_size;
+
+    // unit i covers [unit_start[i], unit_end[i])
+    uint32_t unit_count;
+    const uint16_t* unit_start;
+    const uint16_t* unit_end;
+
+    // run from s->pc through units not flagged in dead, at most budget
+    // instructions. Returns the instructions executed, 0 if s->pc isn't at
+    // the start of a live unit that fits in the budget.
+    int (*run)(State* s, const uint8_t* dead, int budget, Aot_Result* result);
+};
+
+// every generated library exports this
+extern "C" const Aot_Module* chip8_aot_module();
+
+// A library chip8-aot built, opened with dlopen. Only usable if it was
+// built from the same rom, for the same platform and against this State.
+class Aot {
+private:
+    void* handle = nullptr;
+
+public:
+    const Aot_Module* module = nullptr;
+
+// -- Ctor/dtor
+    Aot(const char* fpath, uint64_t rom_hash, Platform platform);
+    ~Aot();
+
+// -- Functions
+    bool available() const;
+
+    // where chip8-aot puts the library for a rom, e.g. "0123456789abcdef-vip.so"
+    static std::string file_name(uint64_t rom_hash, Platform platform);
+};
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include "State.h"
+
+// Machine states for many instances in one contiguous block, each starting
+// on a cache line of its own. Every slot begins as a copy of a power-on
+// image, so resetting or cloning an instance is one memcpy of a State and
+// nothing is allocated per instance. A Chip8 runs on a slot in place; after
+// reset() or clone() overwrite it, call its reload().
+class Arena {
+private:
+    std::vector<State> states;
+    State image;
+
+public:
+// -- Ctor/dtor
+    // count slots, each a copy of image
+    Arena(const State& image, size_t count = 0);
+    ~Arena();
+
+// -- Functions
+    // append count slots at power-on, returns the index of the first. Slots
+    // may move, so references taken before don't survive it.
+    size_t add(size_t count = 1);
+
+    size_t size() const;
+
+    State& operator[](size_t i);
+    const State& operator[](size_t i) const;
+
+    // what reset() copies in
+    const State& power_on() const;
+
+    // slot i back to power-on
+    void reset(size_t i);
+
+    // slot to becomes a copy of slot from
+    void clone(size_t to, size_t from);
+};
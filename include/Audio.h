@@ -0,0 +1,65 @@
+#pragma once
+
+#include <SDL2/SDL.h>
+#include <atomic>
+#include <cstdint>
+
+#define AUDIO_FREQ 44100
+#define AUDIO_SAMPLES 256
+#define AUDIO_TONE 440
+#define AUDIO_VOLUME 3000
+
+// Square wave beeper for the sound timer. The core pushes on/off edges,
+// stamped with the emulated cycle they happened at, into a lock-free single
+// producer single consumer ring. The SDL audio callback replays them against
+// its own cycle clock so every edge lands on its sample; it never locks or
+// allocates.
+class Audio {
+private:
+// -- Edge ring
+    struct Edge {
+        uint64_t cycle;
+        bool on;
+    };
+
+    // power of two, a frame makes at most a couple of edges
+    static const uint32_t RING_SIZE = 64;
+    Edge ring[RING_SIZE];
+
+    // free running counters, head written by the core, tail by the callback
+    std::atomic<uint32_t> head{ 0 };
+    std::atomic<uint32_t> tail{ 0 };
+
+// -- Audio thread
+    SDL_AudioDeviceID device = 0;
+
+    // emulated cycle the next sample plays at
+    double clock = 0;
+    double cycles_per_sample = 0;
+
+    // cycles in a 60hz frame, the latency the clock is held at
+    double frame = 0;
+
+    bool on = false;
+    uint32_t phase = 0;
+    uint32_t period = 0;
+
+    static void callback(void* self, Uint8* stream, int len);
+
+    // synthesize count samples, applying the edges due on the way
+    void fill(int16_t* out, int count);
+
+public:
+// -- Ctor/dtor
+    // ipf is the emulated speed, which sets how cycles map to samples
+    Audio(int ipf);
+    ~Audio();
+
+    // false when no audio device could be opened; push() still works
+    bool available() const;
+
+// -- Core thread
+    // the beeper turned on or off at cycle. Dropped if the callback has
+    // fallen a whole ring behind; the next edge carries the state again.
+    void push(bool on, uint64_t cycle);
+};
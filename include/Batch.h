@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "Chip8.h"
+#include "Headless.h"
+
+// Runs many independent headless machines across all cores. Every machine
+// is a task; each worker drains its own queue from the back and steals from
+// the front of the others once it runs dry.
+class Batch {
+public:
+    struct Result {
+        uint64_t hash;
+        uint64_t cycles;
+        Chip8::Registers regs;
+    };
+
+private:
+    // one machine and the host it runs against
+    struct Instance {
+        Headless host;
+        uint64_t cycles = 0;
+        Chip8 chip;
+
+        Instance(const std::vector<uint8_t>& rom, uint64_t seed, int ipf);
+    };
+
+    // per worker task queue
+    struct Queue {
+        std::mutex lock;
+        std::deque<size_t> tasks;
+    };
+
+    std::vector<std::unique_ptr<Instance>> instances;
+    unsigned threads;
+    Chip8::Engine engine;
+    int ipf;
+
+    // compiled code every machine shares with the AOT engine
+    const Aot* aot = nullptr;
+
+    // pop from our own queue, else steal from someone else's
+    bool next_task(std::vector<Queue>& queues, unsigned id, size_t& task);
+
+    void worker(std::vector<Queue>& queues, unsigned id, uint64_t budget);
+
+public:
+// -- Ctor/dtor
+    // threads = 0 uses every core
+    Batch(unsigned threads = 0, Chip8::Engine engine = Chip8::CACHED, int ipf = 16);
+    ~Batch();
+
+// -- Functions
+    // library chip8-aot built for the rom, attached to every machine
+    void attach(const Aot* code);
+
+    // add a machine running rom with its own random seed, returns its index
+    size_t add(const std::vector<uint8_t>& rom, uint64_t seed);
+
+    // advance every machine by budget instructions
+    std::vector<Result> run(uint64_t budget);
+
+    // read a rom file into memory
+    static std::vector<uint8_t> load(const char* fpath);
+};
@@ -3,134 +3,143 @@
 #include <cstdint>
 #include <fstream>
 #include <iostream>
-#include "Window.h"
+#include <memory>
+#include <vector>
+#include "Font.h"
+#include "Framebuffer.h"
+#include "Host.h"
+#include "Jit.h"
+#include "Profiler.h"
+#include "Quirks.h"
+#include "Random.h"
+#include "State.h"
 
+class Analysis;
+class Aot;
+
+// bytes of memory per hashed chunk, and slots in the table of recent state
+// hashes, see check_cycle()
+#define CYCLE_CHUNK 64
+#define CYCLE_SLOTS 1024
+
+// The engine: runs a State, owned or borrowed, and keeps everything derived
+// from it (decoded and compiled code, idle and cycle tracking) to itself.
 class Chip8 {
 private:
-    Window& window;
-    uint64_t& time;
-
-// -- Memory
-    // 16-bit program counter
-    uint16_t pc = 0x200;
-    // 4096 bytes of memory: 0x0-0xFFF (address space): 0x0-0x1FF (reserved)
-    uint8_t memory[4096] = {
-        // 0
-        0b11110000,
-        0b10010000,
-        0b10010000,
-        0b10010000,
-        0b11110000,
-        // 1
-        0b00100000,
-        0b01100000,
-        0b00100000,
-        0b00100000,
-        0b01110000,
-        // 2
-        0b11110000,
-        0b00010000,
-        0b11110000,
-        0b10000000,
-        0b11110000,
-        // 3
-        0b11110000,
-        0b00010000,
-        0b11110000,
-        0b00010000,
-        0b11110000,
-        // 4
-        0b10010000,
-        0b10010000,
-        0b11110000,
-        0b00010000,
-        0b00010000,
-        // 5
-        0b11110000,
-        0b10000000,
-        0b11110000,
-        0b00010000,
-        0b11110000,
-        // 6
-        0b11110000,
-        0b10000000,
-        0b11110000,
-        0b10010000,
-        0b11110000,
-        // 7
-        0b11110000,
-        0b00010000,
-        0b00100000,
-        0b01000000,
-        0b01000000,
-        // 8
-        0b11110000,
-        0b10010000,
-        0b11110000,
-        0b10010000,
-        0b11110000,
-        // 9
-        0b11110000,
-        0b10010000,
-        0b11110000,
-        0b00010000,
-        0b00010000,
-        // A
-        0b11110000,
-        0b10010000,
-        0b11110000,
-        0b10010000,
-        0b10010000,
-        // B
-        0b11100000,
-        0b10010000,
-        0b11100000,
-        0b10010000,
-        0b11100000,
-        // C
-        0b11110000,
-        0b10000000,
-        0b10000000,
-        0b10000000,
-        0b11110000,
-        // D
-        0b11100000,
-        0b10010000,
-        0b10010000,
-        0b10010000,
-        0b11100000,
-        // E
-        0b11110000,
-        0b10000000,
-        0b11110000,
-        0b10000000,
-        0b11110000,
-        // F
-        0b11110000,
-        0b10000000,
-        0b11110000,
-        0b10000000,
-        0b10000000,
-        0
+// -- Machine state
+    // set when the machine loaded its rom itself
+    std::unique_ptr<State> owned;
+
+    // all the rom can see; everything below only caches or watches it
+    State& s;
+
+// -- Predecoded instructions
+    struct Op;
+    typedef void (*Handler)(Chip8& c, const Op& op);
+
+    // one decoded instruction: the handler plus every operand field
+    struct Op {
+        Handler fn;
+        uint16_t instr;
+        uint16_t nnn;
+        uint8_t x;
+        uint8_t y;
+        uint8_t n;
+        uint8_t nn;
+
+        // operands of the instructions a fused entry also covers
+        uint16_t nnn2;
+        uint8_t x2;
+        uint8_t nn2;
+        uint8_t n3;
+    };
+
+    Host& host;
+
+    // instructions per 60hz frame
+    int ipf = 16;
+
+// -- Idle loops
+    // Keys only change between frames and the timers only at frame
+    // boundaries, so if the machine comes back to an identical state within
+    // a frame it will keep repeating that loop until the frame ends.
+    struct Idle {
+        uint16_t pc;
+        // ~0 marks no previous check
+        uint64_t frames = ~0ull;
+        uint64_t cycles;
+        uint64_t effects;
+        uint64_t rng_state;
+        uint16_t reg_i;
+        uint8_t sp;
+        uint8_t reg_t;
+        uint8_t reg_s;
+        uint8_t reg_v[16];
+        bool key_wait;
+        bool key_held[16];
+    };
+    Idle idle = Idle();
+    bool idle_skip = true;
+
+    // a backward jump, FX0A or FX18 just ran; run loops stop so tick() and
+    // check_idle() see it
+    bool idle_check = false;
+
+    // memory writes, draws and stack operations so far; if unchanged then
+    // memory, the screen and the stack are too
+    uint64_t effects = 0;
+
+    uint64_t cycles_skipped = 0;
+
+    // compare against the last check and jump to the end of the frame if idle
+    void check_idle();
+
+    // halted on FX0A: finish the wait if a key was just pressed, otherwise
+    // let up to budget instructions' worth of time pass. Returns that time.
+    int wait_key(int budget);
+
+// -- Cycles across frames
+    // With a horizon set, the whole state but the counters is hashed at
+    // frame boundaries. A hash seen before, with the keys unchanged since,
+    // is a possible cycle: the state is kept and compared in full one period
+    // later, and if it matches every whole period up to the horizon is
+    // skipped. Memory and the screen are hashed in pieces, only the ones
+    // written since the last check again.
+    uint64_t cycle_horizon = 0;
+
+    uint64_t chunk_hash[4096 / CYCLE_CHUNK] = { 0 };
+    uint64_t row_hash[BUF_HEIGHT] = { 0 };
+    uint64_t memory_sum = 0;
+    uint64_t screen_sum = 0;
+
+    // pieces written since they were last hashed
+    uint64_t chunks_dirty = ~0ull;
+    uint32_t rows_dirty = ~0u;
+
+    // recent hashes, the newest one wins a slot
+    struct Seen {
+        uint64_t hash;
+        uint64_t cycles;
     };
+    Seen seen[CYCLE_SLOTS] = {};
 
-// -- Stack
-    // 8-bit stack pointer 
-    uint8_t sp = 0;
-    // 16 16-bit stack spaces
-    uint16_t stack[16] = { 0 };
+    // keys at the last check and the cycle they changed at
+    uint16_t cycle_keys = 0;
+    uint64_t keys_since = 0;
 
-// -- Registers
-    // 16 8-bit general purpose registers; V[0xF] reserved by instruction set
-    uint8_t reg_v[16] = { 0 };
+    // the state a possible cycle started from, 0 period if none
+    std::unique_ptr<State> candidate;
+    uint64_t candidate_cycles = 0;
+    uint64_t candidate_period = 0;
 
-    // 16-bit memory address index register (need 12-bits)
-    uint16_t reg_i = 0;
+    // hash of everything but frames, cycles and the dirty rows
+    uint64_t state_hash();
 
-    // two special registers for timer and sound
-    uint8_t reg_t = 0;
-    uint8_t reg_s = 0;
+    // the same state as saved, apart from the counters
+    bool same_as(const State& saved) const;
 
+    // record this frame boundary and skip ahead if a cycle is confirmed
+    void check_cycle();
 // -- instructions
     // Code 0x0
     void cls0();
@@ -160,13 +169,13 @@ private:
 
     // Code 0x8
     void ld8(uint8_t vx, uint8_t vy);
-    void or8(uint8_t vx, uint8_t vy);
-    void and8(uint8_t vx, uint8_t vy);
-    void xor8(uint8_t vx, uint8_t vy);
+    template <class Q> void or8(uint8_t vx, uint8_t vy);
+    template <class Q> void and8(uint8_t vx, uint8_t vy);
+    template <class Q> void xor8(uint8_t vx, uint8_t vy);
     void add8(uint8_t vx, uint8_t vy);
     void sub8(uint8_t vx, uint8_t vy);
-    void shr8(uint8_t vx, uint8_t vy);
-    void shl8(uint8_t vx, uint8_t vy);
+    template <class Q> void shr8(uint8_t vx, uint8_t vy);
+    template <class Q> void shl8(uint8_t vx, uint8_t vy);
     void subn8(uint8_t vx, uint8_t vy);
 
     // Code 0x9
@@ -176,13 +185,13 @@ private:
     void ldA(uint16_t addr);
 
     // Code 0xB
-    void jpB(uint16_t addr);
+    template <class Q> void jpB(uint16_t addr);
 
     // Code 0xC
     void rndC(uint8_t vx, uint8_t byte);
 
     // Code 0xD
-    void drwD(uint8_t vx, uint8_t vy, uint8_t nibble);
+    template <class Q> void drwD(uint8_t vx, uint8_t vy, uint8_t nibble);
 
     // Code 0xE
     void skpE(uint8_t vx);
@@ -196,16 +205,215 @@ private:
     void ldF_1E(uint8_t vx);
     void ldF_29(uint8_t vx);
     void ldF_33(uint8_t vx);
-    void ldF_55(uint8_t vx);
-    void ldF_65(uint8_t vx);
+    template <class Q> void ldF_55(uint8_t vx);
+    template <class Q> void ldF_65(uint8_t vx);
+
+    template <class Q> void run_instr(uint16_t instr);
+
+// -- Predecode cache
+    // decoded form of the instruction starting at every address, filled lazily
+    Op cache[4096];
+
+    // build the cache entry for an instruction
+    template <class Q> static Op decode(uint16_t instr);
+
+    // drop cached entries overlapping a written byte
+    void invalidate(uint16_t addr);
+
+    // drop everything decoded or compiled
+    void invalidate_all();
+
+    // decode every instruction an analysis found reachable
+    template <class Q> void prepare_cache(const Analysis& analysis);
+
+    // adapters from a cache entry to the instruction functions
+    template <class Q> static void exec_decode(Chip8& c, const Op& op);
+    static void exec_unknown(Chip8& c, const Op& op);
+    template <void (Chip8::*F)()> static void exec(Chip8& c, const Op& op);
+    template <void (Chip8::*F)(uint16_t)> static void exec_nnn(Chip8& c, const Op& op);
+    template <void (Chip8::*F)(uint8_t)> static void exec_x(Chip8& c, const Op& op);
+    template <void (Chip8::*F)(uint8_t, uint8_t)> static void exec_xnn(Chip8& c, const Op& op);
+    template <void (Chip8::*F)(uint8_t, uint8_t)> static void exec_xy(Chip8& c, const Op& op);
+    template <void (Chip8::*F)(uint8_t, uint8_t, uint8_t)> static void exec_xyn(Chip8& c, const Op& op);
+
+    // execute one cache entry, without the timers, running at most budget
+    // instructions. Returns the instructions executed.
+    template <class P> int step_cached(P& profile, int budget);
+
+// -- Superinstructions
+    // Common sequences are decoded into one entry at their first address;
+    // the addresses inside keep their own entries, so jumping into the
+    // middle runs the plain instructions. A fused entry only runs as far as
+    // step_budget allows, so frame boundaries stay exact.
+    int step_budget = 1;
+
+    // extra instructions the last fused entry ran
+    int step_fused = 0;
+
+    // bytes some entry looked at past its own instruction
+    bool in_fused[4096] = { 0 };
+
+    // turn op, decoded at addr, into a superinstruction if a known
+    // sequence starts there
+    template <class Q> static void fuse(Chip8& c, uint16_t addr, Op& op);
+
+    // 6XNN 6YNN, and 6XNN 6YNN DXYN drawing at VX, VY
+    static void fuse_ld_ld(Chip8& c, const Op& op);
+    template <class Q> static void fuse_ld_ld_drw(Chip8& c, const Op& op);
+
+    // ANNN FX1E
+    static void fuse_ldi_addi(Chip8& c, const Op& op);
 
-    void run_instr(uint16_t instr);
+    // 3XNN / 4XNN / EX9E / EXA1 then 1NNN, the jump runs unless skipped
+    template <Handler SKIP> static void fuse_skip_jp(Chip8& c, const Op& op);
+
+// -- Platform
+    // Quirks profile every path below dispatches to: run() and
+    // run_threaded() switch on it once per call, the cache through decoder
+    // and the recompiler through the flags it was built with.
+    Platform platform = VIP;
+    Handler decoder = exec_decode<Vip>;
+
+    template <class Q, class P> int run_as(P& profile);
+    template <class Q> int run_threaded_as();
+
+    // the quirks the recompiler has to emit code for
+    template <class Q> static Jit::Quirks jit_quirks() {
+        Jit::Quirks quirks;
+        quirks.vf_reset = Q::vf_reset;
+        quirks.shift_vx = Q::shift_vx;
+        quirks.memory_increment = Q::memory_increment;
+        return quirks;
+    }
+
+// -- Recompiler
+    std::unique_ptr<Jit> jit;
+
+    // build the recompiler for the current platform
+    void start_jit();
+
+// -- Ahead-of-time code
+    // library chip8-aot built for this rom, nullptr if none
+    const Aot* aot = nullptr;
+
+    // 1 + the unit covering every byte of memory, 0 if none
+    uint16_t aot_unit[4096] = { 0 };
+
+    // units whose bytes no longer match what was compiled
+    std::vector<uint8_t> aot_dead;
+
+    // compare every unit against memory again
+    void check_aot();
+
+    // the host was last told the beeper is on
+    bool beeping = false;
+
+    // count executed instructions; at each frame boundary decrement the
+    // timers and hand the frame to the host. Beeper edges go to the host as
+    // they happen.
+    void tick(int count);
 public:
-    Chip8(Window& w, uint64_t& t, const char* fpath);
+    // copy of the cpu registers for reporting
+    struct Registers {
+        uint16_t pc;
+        uint16_t reg_i;
+        uint8_t sp;
+        uint8_t reg_v[16];
+        uint8_t reg_t;
+        uint8_t reg_s;
+    };
+
+    enum Engine { INTERPRETER, CACHED, JIT, THREADED, AOT };
+
+    // load a rom into a state of the machine's own
+    Chip8(Host& h, const char* fpath);
+    Chip8(Host& h, const uint8_t* rom, size_t size);
+    // run on state in place, such as an Arena slot; it must outlive the machine
+    Chip8(Host& h, State& state);
     ~Chip8();
 
+    // restart the random number sequence used by CXNN
+    void seed(uint64_t value);
+
+    // emulated speed in instructions per 60hz frame
+    void set_ipf(int instructions);
+
+    // switch quirk profile (VIP by default), dropping decoded and compiled code
+    void set_platform(Platform p);
+
+    // fast-forward through idle loops (on by default)
+    void set_idle_skip(bool enabled);
+
+    // fast-forward through cycles in the machine's state, never past
+    // instruction horizon; 0 (the default) turns it off. Skipped frames
+    // aren't rendered, so only for hosts that don't count frames.
+    void set_cycle_skip(uint64_t horizon);
+
+    // instructions fast-forwarded by idle loop and cycle detection
+    uint64_t skipped() const;
+
+    // frames completed since power-on
+    uint64_t frame_count() const;
+
+    Registers registers() const;
+
+    // the screen as currently drawn
+    const Framebuffer& framebuffer() const;
+
+    // copy the whole machine out / back in
+    void snapshot(State& out) const;
+    void restore(const State& in);
+
+    // the state was overwritten from outside, e.g. by Arena::reset() or
+    // clone(): drop everything decoded, compiled or hashed from the old one
+    void reload();
+
     void memory_dump();
+    void register_dump();
+
+    // true when both machines are in exactly the same state
+    bool same_state(const Chip8& other) const;
+
+    // decode (CACHED, AOT) or compile (JIT) every block an analysis of the rom
+    // found, so the first frames don't pay for it. Other engines ignore it.
+    void prepare(const Analysis& analysis, Engine engine);
+
+    // run the code chip8-aot compiled for this rom with the AOT engine;
+    // units are dropped as soon as the bytes they came from are written
+    void attach(const Aot* code);
+
+    // run until the end of the current frame
+    void run_frame(Engine engine = CACHED);
+
+    // fetch, decode and execute one instruction. Returns the instructions'
+    // worth of time that passed, more than 1 while halted on FX0A.
+    int run();
+
+    // execute up to count instructions through the predecode cache (0 runs to
+    // the end of the frame), then update the timers. Stops early after a
+    // backward jump. Returns the instructions executed.
+    int run_cached(int count = 0);
+
+    // the same, reporting every instruction to an instrumentation policy
+    // (NoProfile or Profiler). The recompiler can't be profiled, so JIT
+    // frames run through the cache instead.
+    template <class P> void run_frame(Engine engine, P& profile);
+    template <class P> int run(P& profile);
+    template <class P> int run_cached(int count, P& profile);
+
+    // execute one recompiled block (or one instruction the recompiler can't
+    // handle), then update the timers. Returns the instructions executed.
+    int run_jit();
+
+    // execute compiled units up to the end of the frame (or the next
+    // backward jump), one instruction through the cache where there are
+    // none, then update the timers. Returns the instructions executed.
+    // Without a library attached this is run_cached().
+    int run_aot();
 
-    void run();
+    // execute up to the end of the frame (or the next backward jump) with
+    // threaded dispatch, then update the timers. Returns the instructions
+    // executed. Without computed goto this is one run().
+    int run_threaded();
 };
 
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+
+#define BUF_WIDTH 64
+#define BUF_HEIGHT 32
+
+// 64x32 monochrome screen, one bit per pixel. Each row is a single word with
+// x = 0 in the most significant bit, so a sprite row is drawn with one
+// shift and one XOR.
+struct Framebuffer {
+    uint64_t rows[BUF_HEIGHT] = { 0 };
+
+    // bit y set when row y changed since the last presented frame; whoever
+    // presents the frame clears it
+    uint32_t dirty = ~0u;
+
+    // Turn every pixel off
+    void clear();
+
+    // Check the state of a pixel
+    bool get_pixel(int x, int y) const;
+
+    // XOR an 8 pixel sprite row in at (x, y), clipping at the right edge.
+    // Returns true if any pixel was turned off.
+    bool draw_row(int x, int y, uint8_t sprite);
+
+    // the same, wrapping pixels past the right edge round to the left
+    bool draw_row_wrapped(int x, int y, uint8_t sprite);
+
+    // FNV-1a hash of the screen
+    uint64_t hash() const;
+};
+
+// the drawing primitives are inline: they run inside every DXYN and the
+// ahead-of-time compiled code calls them too
+inline void Framebuffer::clear() {
+    for (int y = 0; y < BUF_HEIGHT; y++) {
+        if (rows[y] != 0) {
+            dirty |= 1u << y;
+        }
+        rows[y] = 0;
+    }
+}
+
+inline bool Framebuffer::draw_row(int x, int y, uint8_t sprite) {
+    // bits shifted past the right edge are simply dropped
+    uint64_t bits = uint64_t(sprite) << 56 >> x;
+    bool collision = (rows[y] & bits) != 0;
+    rows[y] ^= bits;
+    if (bits != 0) {
+        dirty |= 1u << y;
+    }
+    return collision;
+}
+
+inline bool Framebuffer::draw_row_wrapped(int x, int y, uint8_t sprite) {
+    // rotate instead of shift
+    uint64_t bits = uint64_t(sprite) << 56;
+    bits = (bits >> x) | (bits << ((64 - x) & 63));
+    bool collision = (rows[y] & bits) != 0;
+    rows[y] ^= bits;
+    if (bits != 0) {
+        dirty |= 1u << y;
+    }
+    return collision;
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <set>
+#include <vector>
+#include "Chip8.h"
+#include "Host.h"
+#include "Profiler.h"
+#include "Quirks.h"
+#include "Replay.h"
+
+// Coverage-guided fuzzing of what a rom is fed: key timelines and rng seeds,
+// kept as input logs. Every trial restores the machine from a power-on
+// snapshot (one memcpy), plays a mutated log through the cache and records
+// the pc -> pc edges it took; logs that take a new edge or hit a new fault
+// join the corpus. Workers on every core share the corpus and the coverage.
+class Fuzzer {
+public:
+    // the first trial to hit a fault at a given address
+    struct Event {
+        Fault fault;
+        // frames completed before it
+        uint64_t frame;
+        uint64_t trial;
+        // plays back to the fault with --replay
+        InputLog input;
+    };
+
+private:
+    // host for one trial: keys from the log, faults collected instead of
+    // printed
+    class Target : public Host {
+    private:
+        const InputLog* log = nullptr;
+        size_t next_keys = 0;
+        uint16_t keys = 0;
+
+    public:
+        uint64_t frames = 0;
+        std::vector<Event> faults;
+
+        void start(const InputLog& input);
+
+        void render(const Framebuffer& frame) override;
+        void poll() override;
+        bool get_key_press(int idx) override;
+        void fault(const Fault& f) override;
+    };
+
+    InputLog settings;
+    // every trial and every worker's machine starts from here
+    State power_on;
+    uint64_t frames;
+
+// -- Shared between workers
+    std::mutex lock;
+    std::vector<InputLog> corpus;
+    uint8_t coverage[Coverage::EDGES / 8] = { 0 };
+    uint64_t edges = 0;
+    std::set<uint32_t> seen;
+    std::vector<Event> found;
+    uint64_t next_trial = 0;
+
+    // one to four edits of input's keys or seed; splices take events
+    // from other
+    void mutate(InputLog& input, const InputLog& other, uint64_t& rng) const;
+
+    // play input from the power-on state until frame stop
+    template <class P> void play(Chip8& chip, Target& target, const State& start,
+        const InputLog& input, uint64_t stop, P& profile);
+
+    // merge a trial's coverage and faults; known is the worker's copy of the
+    // shared coverage, so trials that found nothing never take the lock
+    void merge(const Coverage& trial, uint8_t* known, Target& target, const InputLog& input, uint64_t id);
+
+    // input as a full log, frame hashes included, up to the fault
+    InputLog reproduce(const InputLog& input, const Event& event) const;
+
+    void worker(unsigned id, uint64_t end);
+
+public:
+// -- Ctor/dtor
+    // trials of frames each, against a rom with the given settings
+    Fuzzer(const std::vector<uint8_t>& rom, uint64_t rom_hash, int ipf, Platform platform, uint64_t frames);
+    ~Fuzzer();
+
+// -- Functions
+    // run trials across threads workers, 0 uses every core
+    void run(uint64_t trials, unsigned threads = 0);
+
+    // edges seen so far, out of Coverage::EDGES
+    uint64_t edge_count() const;
+
+    size_t corpus_size() const;
+
+    // in the order they were found
+    const std::vector<Event>& events() const;
+};
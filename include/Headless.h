@@ -0,0 +1,24 @@
+#pragma once
+
+#include "Host.h"
+
+// Pure in-memory host: no SDL, no display, no wall clock, so a ROM runs at
+// full host speed.
+class Headless : public Host {
+private:
+    bool key_pressed[16] = { 0 };
+
+public:
+// -- Ctor/dtor
+    Headless();
+    ~Headless();
+
+// -- Host
+    void render(const Framebuffer& frame) override;
+    void poll() override;
+    bool get_key_press(int idx) override;
+
+// -- Functions
+    // Drive a key from outside (scripts, bots)
+    void set_key(int idx, bool down);
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include "Framebuffer.h"
+
+// Something a rom did that the machine has no answer for. The instruction
+// does nothing and emulation carries on.
+struct Fault {
+    enum Kind { STACK_OVERFLOW, STACK_UNDERFLOW, UNKNOWN_INSTRUCTION };
+
+    Kind kind;
+    // address and encoding of the instruction
+    uint16_t pc;
+    uint16_t instr;
+
+    // e.g. "stack_overflow"
+    static const char* name(Kind kind);
+};
+
+// Everything the Chip8 core needs from the outside world: somewhere to show
+// frames and somewhere to read keys from. Time is virtual: the core counts
+// instructions, so pacing against the wall clock is up to the caller.
+class Host {
+public:
+    bool running = true;
+
+    virtual ~Host() {}
+
+// -- Display
+    // Present a finished frame
+    virtual void render(const Framebuffer& frame) = 0;
+
+// -- Input
+    // poll events
+    virtual void poll() = 0;
+
+    // check if key idx (0-F) has been pressed
+    virtual bool get_key_press(int idx) = 0;
+
+// -- Sound
+    // the beeper turned on or off at an emulated cycle
+    virtual void beep(bool, uint64_t) {}
+
+// -- Faults
+    // the rom hit a fault, reported on stderr unless overridden
+    virtual void fault(const Fault& f);
+};
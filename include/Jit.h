@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <initializer_list>
+#include <vector>
+
+// x86-64 dynamic recompiler for straight-line runs of Chip8 instructions.
+// Compiled blocks work directly on the machine they were built for: every
+// register is addressed as an offset from the pointer passed in rdi, and
+// the instruction budget to the frame boundary is passed in esi.
+class Jit {
+public:
+    // byte offsets of the machine state from the machine pointer
+    struct Layout {
+        int32_t pc;
+        int32_t reg_v;
+        int32_t reg_i;
+        int32_t reg_t;
+        int32_t reg_s;
+        int32_t memory;
+    };
+
+    // platform behaviour baked into the emitted code, see Quirks.h
+    struct Quirks {
+        bool vf_reset;
+        bool shift_vx;
+        bool memory_increment;
+    };
+
+    // runs at most budget instructions and returns how many it ran; a block
+    // cut short leaves pc at the first instruction it didn't run
+    typedef int (*Block)(void* machine, int budget);
+
+    struct Entry {
+        // native code, nullptr if the first instruction can't be compiled
+        Block fn = nullptr;
+        // instructions executed by one call given the budget
+        uint16_t count = 0;
+        // ends with a jump backwards, a possible idle loop
+        bool loops = false;
+        bool compiled = false;
+    };
+
+private:
+    Layout layout;
+    Quirks quirks;
+
+// -- Code cache
+    uint8_t* code = nullptr;
+    size_t code_size = 0;
+    size_t code_used = 0;
+
+    // compiled block starting at every address
+    Entry blocks[4096];
+
+    // memory bytes that have been compiled into some block
+    bool in_block[4096] = { 0 };
+
+    // code being emitted for the current block
+    std::vector<uint8_t> buf;
+    bool blocks_loop = false;
+
+// -- Emitters
+    void emit(std::initializer_list<uint8_t> bytes);
+    void emit32(int32_t value);
+    void emit16(uint16_t value);
+
+    // op [rdi + disp32] forms
+    void emit_mem(std::initializer_list<uint8_t> op, int32_t disp);
+
+    // pc = addr, or addr + 2 when the flags say skip
+    void emit_skip(uint8_t jcc_no_skip, uint16_t next);
+    void emit_set_pc(uint16_t addr);
+
+    // leave with pc = addr when the budget is done after count instructions
+    void emit_budget_check(uint16_t addr, uint16_t count);
+
+    // compile one instruction, false if it has to be left to the interpreter
+    bool compile_instr(uint16_t instr, uint16_t addr, bool& ends_block);
+
+public:
+// -- Ctor/dtor
+    Jit(Layout l, Quirks q);
+    ~Jit();
+
+    // false when executable memory isn't available on this host
+    bool available();
+
+    // block for pc, compiling it on first use
+    const Entry& lookup(uint16_t pc, const uint8_t* memory);
+
+    // memory was written, throw away any code built from it
+    void invalidate(uint16_t addr);
+
+    // drop every block and start the cache again
+    void flush();
+};
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "Chip8.h"
+#include "Framebuffer.h"
+#include "Host.h"
+
+// Vector types holding one byte / word per lane
+template <int LANES> struct Lanes;
+template <> struct Lanes<8> {
+    typedef uint8_t Bytes __attribute__((vector_size(8)));
+    typedef uint16_t Words __attribute__((vector_size(16)));
+};
+template <> struct Lanes<16> {
+    typedef uint8_t Bytes __attribute__((vector_size(16)));
+    typedef uint16_t Words __attribute__((vector_size(32)));
+};
+template <> struct Lanes<32> {
+    typedef uint8_t Bytes __attribute__((vector_size(32)));
+    typedef uint16_t Words __attribute__((vector_size(64)));
+};
+
+// Runs LANES copies of one rom side by side in structure-of-arrays form.
+// Every register is a vector with one element per machine, so when the
+// machines share a pc the instruction is executed for all of them at once
+// with SSE/AVX2 (whatever the compiler targets). Lanes that have wandered
+// off to another pc, and instructions with no vector form, are stepped
+// one lane at a time.
+template <int LANES>
+class Lockstep {
+private:
+    typedef typename Lanes<LANES>::Bytes Bytes;
+    typedef typename Lanes<LANES>::Words Words;
+
+// -- Registers, one element per lane
+    Words pc;
+    Words reg_i;
+    Bytes reg_v[16];
+    Bytes reg_t;
+    Bytes reg_s;
+    Bytes sp;
+    Words stack[16];
+
+// -- Per lane state
+    uint64_t rng_state[LANES];
+    uint16_t keys[LANES];
+    uint16_t key_held[LANES];
+    bool key_wait[LANES];
+    Framebuffer frame[LANES];
+    uint8_t memory[LANES][4096];
+
+    // addresses any lane has written to; code there may differ per lane
+    bool written[4096] = { 0 };
+
+    uint64_t steps = 0;
+    int ipf;
+
+    // where every lane's faults go
+    Host& host;
+
+    // execute the leader's instruction for the lanes in mask, false if it
+    // has no vector form
+    bool step_vector(uint16_t instr, const Bytes& mask, const Words& mask_w);
+
+    // execute one instruction on a single lane
+    void step_lane(int lane);
+
+    void tick();
+
+public:
+    // lane-instructions executed by each path
+    uint64_t vector_count = 0;
+    uint64_t lane_count = 0;
+
+// -- Ctor/dtor
+    // the timers tick every ipf instructions, like Chip8. Faults on any lane
+    // are reported to host; keys come from set_key, never from host.
+    Lockstep(Host& host, const std::vector<uint8_t>& rom, int ipf = 16);
+    ~Lockstep();
+
+// -- Functions
+    void seed(int lane, uint64_t s);
+    void set_key(int lane, int idx, bool down);
+
+    // advance every lane by count instructions
+    void run(uint64_t count);
+
+    const Framebuffer& framebuffer(int lane) const;
+    Chip8::Registers registers(int lane) const;
+};
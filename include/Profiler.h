@@ -0,0 +1,117 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include "Host.h"
+
+// Instrumentation policy the core runs with by default: every hook is an
+// empty inline, so the profiled loops compile to the same code as before.
+struct NoProfile {
+    void instr(uint16_t, uint16_t) {}
+    void fused(uint16_t, int) {}
+};
+
+// Instrumentation policy that sets one bit per pc -> pc edge taken, hashed
+// into a fixed bitmap, for coverage-guided fuzzing
+struct Coverage {
+    static const int EDGES = 1 << 16;
+
+    uint8_t bits[EDGES / 8] = { 0 };
+    uint16_t prev = 0;
+
+    void instr(uint16_t addr, uint16_t) {
+        uint32_t edge = ((uint32_t(prev) << 12 | (addr & 0xFFF)) * 0x9E3779B1u) >> 16;
+        bits[edge >> 3] |= 1 << (edge & 7);
+        prev = addr & 0xFFF;
+    }
+    void fused(uint16_t, int) {}
+};
+
+// Instrumentation policy that counts every executed instruction by opcode
+// class, by address and by sprite height. It also sits between the core and
+// the real host so the time spent in render() can be split from the core.
+class Profiler : public Host {
+public:
+    // opcode classes, in run_instr order
+    enum Class {
+        CLS, RET, SYS, JP, CALL, SE_NN, SNE_NN, SE_XY, LD_NN, ADD_NN,
+        LD_XY, OR, AND, XOR, ADD_XY, SUB, SHR, SUBN, SHL, SNE_XY,
+        LD_I, JP_V0, RND, DRW, SKP, SKNP, LD_DT_READ, LD_KEY, LD_DT, LD_ST,
+        ADD_I, LD_FONT, BCD, STORE, LOAD, UNKNOWN, CLASS_COUNT
+    };
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    Host& inner;
+
+    uint64_t by_class[CLASS_COUNT] = { 0 };
+    uint64_t by_pc[4096] = { 0 };
+    uint16_t instr_at[4096] = { 0 };
+    uint64_t by_height[16] = { 0 };
+
+    // superinstructions run, by the class of their first instruction
+    uint64_t by_fused[CLASS_COUNT] = { 0 };
+    uint64_t fused_saved = 0;
+
+    Clock::duration run_time = Clock::duration::zero();
+    Clock::duration render_time = Clock::duration::zero();
+    Clock::time_point run_start;
+
+    // opcode pattern of a class, e.g. "8XY4"
+    static const char* name(int cls);
+
+    uint64_t total() const;
+
+public:
+// -- Ctor/dtor
+    // inner is the host that actually displays and reads keys
+    Profiler(Host& inner);
+    ~Profiler();
+
+// -- Host
+    void render(const Framebuffer& frame) override;
+    void poll() override;
+    bool get_key_press(int idx) override;
+    void beep(bool on, uint64_t cycle) override;
+    void fault(const Fault& f) override;
+
+// -- Policy
+    // called by the core before executing instr at addr
+    void instr(uint16_t addr, uint16_t instr) {
+        by_class[classify(instr)]++;
+        by_pc[addr & 0xFFF]++;
+        instr_at[addr & 0xFFF] = instr;
+        if ((instr >> 12) == 0xD) {
+            by_height[instr & 0xF]++;
+        }
+    }
+
+    // called by the core after a cache entry at addr ran, extra is how many
+    // instructions past the first it fused
+    void fused(uint16_t addr, int extra) {
+        if (extra > 0) {
+            by_fused[classify(instr_at[addr & 0xFFF])]++;
+            fused_saved += extra;
+        }
+    }
+
+// -- Functions
+    static Class classify(uint16_t instr);
+
+    // bracket the time the core runs, render() time inside is split out
+    void start();
+    void stop();
+
+    // human readable summary: time split, opcode classes, hottest addresses,
+    // sprite heights and superinstruction hits
+    void report(std::ostream& out) const;
+
+    // every counter as kind,key,count rows
+    void write_csv(const char* fpath) const;
+
+    // collapsed stacks (core;class;addr ns) for flamegraph tools, core time
+    // shared between addresses by instruction count
+    void write_collapsed(const char* fpath) const;
+};
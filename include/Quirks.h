@@ -0,0 +1,34 @@
+#pragma once
+
+// Behaviours that differ between chip-8 platforms. Each profile is a type
+// the core is instantiated for, so handlers test compile-time constants
+// instead of branching on a setting.
+template <bool VF_RESET, bool SHIFT_VX, bool MEMORY_INCREMENT, bool CLIP, bool JUMP_VX>
+struct Quirks {
+    // 8XY1, 8XY2 and 8XY3 clear VF
+    static constexpr bool vf_reset = VF_RESET;
+
+    // 8XY6 and 8XYE shift VX in place instead of loading VY shifted
+    static constexpr bool shift_vx = SHIFT_VX;
+
+    // FX55 and FX65 leave I pointing past the last register
+    static constexpr bool memory_increment = MEMORY_INCREMENT;
+
+    // DXYN cuts sprites off at the screen edges instead of wrapping
+    static constexpr bool clip = CLIP;
+
+    // BNNN jumps to NNN + VX instead of NNN + V0
+    static constexpr bool jump_vx = JUMP_VX;
+};
+
+// the original COSMAC VIP interpreter
+typedef Quirks<true, false, true, true, false> Vip;
+
+// SUPER-CHIP 1.1 on the HP48
+typedef Quirks<false, true, false, true, true> SuperChip;
+
+// XO-CHIP and most modern interpreters
+typedef Quirks<false, false, true, false, false> Modern;
+
+// profile picked at runtime, one per typedef above
+enum Platform { VIP, SUPER_CHIP, MODERN };
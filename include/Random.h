@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstdint>
+
+// splitmix64: any seed is fine and the whole generator is one word, cheap
+// enough to keep one per machine
+inline uint8_t random_byte(uint64_t& state) {
+    uint64_t z = (state += 0x9E3779B97F4A7C15);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+    return (z ^ (z >> 31)) >> 56;
+}
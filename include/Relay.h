@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include "Host.h"
+
+// Host for a core running on its own thread. Finished frames go through a
+// lock-free triple buffer to the display thread and keys come back as one
+// atomic mask, so neither side ever waits on the other: a slow present just
+// means the display skips to the newest frame. The core only sees the mask
+// as it was at the last frame boundary, since idle detection relies on
+// keys never changing mid-frame.
+class Relay : public Host {
+private:
+// -- Triple buffer
+    Framebuffer buffers[3];
+
+    // index of the buffer between the two threads, FRESH when it holds a
+    // frame the display hasn't taken yet
+    std::atomic<uint8_t> middle{ 1 };
+    static const uint8_t FRESH = 0x4;
+
+    // owned by the core thread
+    uint8_t back = 0;
+    uint16_t latched = 0;
+
+    // owned by the display thread
+    uint8_t front = 2;
+
+// -- Shared state
+    std::atomic<uint16_t> keys{ 0 };
+    std::atomic<bool> stopped{ false };
+
+public:
+    // rewind hotkey is held, set by the display thread
+    std::atomic<bool> rewinding{ false };
+
+    // called on the core thread after each published frame, e.g. to wake a
+    // display thread sleeping on its event queue
+    std::function<void()> on_frame;
+
+    // called on the core thread with every beeper edge
+    std::function<void(bool, uint64_t)> on_beep;
+
+// -- Ctor/dtor
+    Relay();
+    ~Relay();
+
+// -- Host (core thread)
+    // copy the frame out and publish it, never blocks; then latch the
+    // keys for the next frame
+    void render(const Framebuffer& frame) override;
+    void poll() override;
+    bool get_key_press(int idx) override;
+    void beep(bool on, uint64_t cycle) override;
+
+// -- Display thread
+    // take the newest published frame if there is one. The dirty mask of out
+    // is set to the rows that differ from what it held before.
+    bool fetch(Framebuffer& out);
+
+    // key state as a bit per chip-8 key
+    void set_keys(uint16_t mask);
+
+// -- Shutdown
+    void stop();
+    bool is_stopped() const;
+};
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "Host.h"
+#include "Quirks.h"
+
+// Everything from outside the rom that decides what a session does: the rng
+// seed, the settings, and the key mask at every frame it changed. Keys are
+// latched once per frame (the core already assumes they only change between
+// frames), so frames index the log exactly. The framebuffer hash at every
+// frame it changed is kept too, to check a replay against.
+struct InputLog {
+    struct Keys {
+        uint64_t frame;
+        uint16_t mask;
+    };
+
+    struct Check {
+        uint64_t frame;
+        uint64_t hash;
+    };
+
+    uint64_t seed = 0;
+    int ipf = 16;
+    Platform platform = VIP;
+    uint64_t rom_hash = 0;
+
+    // frames recorded
+    uint64_t frames = 0;
+
+    // both in frame order
+    std::vector<Keys> keys;
+    std::vector<Check> checks;
+
+// -- Functions
+    // little-endian varints throughout, so a log replays the same anywhere
+    void save(const char* fpath) const;
+    void load(const char* fpath);
+
+    // FNV-1a of a rom file, a log only replays against the rom it was made on
+    static uint64_t hash_file(const char* fpath);
+
+    // the same for a rom already in memory
+    static uint64_t hash_rom(const uint8_t* rom, size_t size);
+};
+
+// Host that sits between the core and the real host while recording: keys
+// are read from inner at frame boundaries only, and every change goes into
+// the log along with the frame hashes.
+class Recorder : public Host {
+private:
+    Host& inner;
+    InputLog& log;
+
+    uint16_t keys = 0;
+    uint64_t last_hash;
+
+public:
+// -- Ctor/dtor
+    Recorder(Host& inner, InputLog& log);
+    ~Recorder();
+
+// -- Host
+    void render(const Framebuffer& frame) override;
+    void poll() override;
+    bool get_key_press(int idx) override;
+    void beep(bool on, uint64_t cycle) override;
+    void fault(const Fault& f) override;
+};
+
+// Host that plays a log back: keys change at the frames they were recorded
+// at and every frame's hash is checked against the recording.
+class Replayer : public Host {
+private:
+    const InputLog& log;
+
+    uint64_t frames = 0;
+    size_t next_keys = 0;
+    size_t next_check = 0;
+
+    uint16_t keys = 0;
+    uint64_t expected;
+
+    // first frame whose hash didn't match, 0 if none
+    uint64_t mismatch = 0;
+
+public:
+// -- Ctor/dtor
+    Replayer(const InputLog& log);
+    ~Replayer();
+
+// -- Host
+    void render(const Framebuffer& frame) override;
+    void poll() override;
+    bool get_key_press(int idx) override;
+
+// -- Functions
+    // every recorded frame has been played
+    bool done() const;
+
+    uint64_t frame() const;
+    uint64_t first_mismatch() const;
+};
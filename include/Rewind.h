@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include "State.h"
+
+// History of machine states, one per frame. Every KEYFRAME_INTERVAL frames
+// a full State is kept; the frames in between are stored as the XOR against
+// that keyframe, run-length encoded, so a frame costs a few dozen bytes.
+class Rewind {
+private:
+    // a keyframe and the deltas that decode against it
+    struct Segment {
+        State key;
+        std::vector<std::vector<uint8_t>> deltas;
+    };
+
+    std::deque<Segment> segments;
+    size_t budget;
+    size_t used = 0;
+
+// -- Delta coding
+    // XOR against the keyframe as (zero run, literal run, literals) varints
+    static void encode(const State& key, const State& frame, std::vector<uint8_t>& out);
+    static void decode(const State& key, const std::vector<uint8_t>& in, State& frame);
+
+    static void put_varint(std::vector<uint8_t>& out, size_t value);
+    static size_t get_varint(const std::vector<uint8_t>& in, size_t& pos);
+
+public:
+// -- Ctor/dtor
+    // budget is the most bytes of history to keep before dropping the oldest
+    Rewind(size_t budget = 4 << 20);
+    ~Rewind();
+
+// -- Functions
+    // record the state at the end of a frame
+    void push(const State& frame);
+
+    // take back the most recent frame, false once history runs out
+    bool pop(State& frame);
+
+    // frames currently held
+    size_t size() const;
+
+    // bytes currently held
+    size_t bytes() const;
+};
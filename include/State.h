@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include "Font.h"
+#include "Framebuffer.h"
+
+#define CACHE_LINE 64
+
+// Everything that makes up a running machine. Trivially copyable, so a
+// snapshot or a restore is a single memcpy. The registers every instruction
+// touches share the first cache line with the stack, the counters take the
+// second, and memory and the screen start on lines of their own, so copying
+// or comparing one part never drags in another.
+struct alignas(CACHE_LINE) State {
+// -- Registers
+    // 16-bit program counter
+    uint16_t pc = 0x200;
+
+    // 16-bit memory address index register (need 12-bits)
+    uint16_t reg_i = 0;
+
+    // 8-bit stack pointer
+    uint8_t sp = 0;
+
+    // two special registers for timer and sound
+    uint8_t reg_t = 0;
+    uint8_t reg_s = 0;
+
+    // halted on FX0A until a fresh key press lands in V[key_reg]; keys
+    // already held when the wait started don't count
+    bool key_wait = false;
+
+    // 16 8-bit general purpose registers; V[0xF] reserved by instruction set
+    uint8_t reg_v[16] = { 0 };
+
+// -- Stack
+    // 16 16-bit stack spaces
+    uint16_t stack[16] = { 0 };
+
+    uint8_t key_reg = 0;
+
+// -- Timing
+    // instructions executed so far in the current frame
+    alignas(CACHE_LINE) uint32_t frame_cycles = 0;
+    // frames completed
+    uint64_t frames = 0;
+    // instructions executed, including any skipped as idle
+    uint64_t cycles = 0;
+
+// -- Random numbers
+    // per machine generator so results are reproducible and threads don't share state
+    uint64_t rng_state = 0;
+
+// -- Input
+    bool key_held[16] = { 0 };
+
+// -- Memory
+    // 4096 bytes of memory: 0x0-0xFFF (address space): 0x0-0x1FF (reserved)
+    alignas(CACHE_LINE) uint8_t memory[4096] = { 0 };
+
+// -- Display
+    alignas(CACHE_LINE) Framebuffer frame;
+
+    // back to power-on: everything cleared, pc at 0x200, the font at 0x0
+    void reset();
+};
+
+inline void State::reset() {
+    *this = State();
+    memcpy(memory, FONT, FONT_SIZE);
+}
+
+static_assert(std::is_trivially_copyable<State>::value, "State must stay memcpy-able");
+static_assert(offsetof(State, key_reg) < CACHE_LINE, "registers and stack must share one cache line");
+static_assert(offsetof(State, memory) % CACHE_LINE == 0 && offsetof(State, frame) % CACHE_LINE == 0,
+    "memory and the screen must start on their own cache lines");
@@ -1,21 +1,20 @@
 #pragma once
 
 #include <SDL2/SDL.h>
-#include <unordered_map>
 #include <iostream>
+#include "Host.h"
 
 #define WIN_NAME "Chip-8 Emulator"
 #define WIN_WIDTH 1024
 #define WIN_HEIGHT 512
-#define BUF_WIDTH 64
-#define BUF_HEIGHT 32
 
 #define ON 0xFC
 #define OFF 0x13
 
-typedef std::unordered_map<SDL_Keycode, uint8_t> Key_Lut;
+// default layout: the keyboard keys for chip-8 keys 0 through F
+#define KEY_LAYOUT "x123qweasdzc4rfv"
 
-class Window {
+class Window : public Host {
 private:
 // -- Variables
     SDL_Window* window = nullptr;
@@ -25,48 +24,70 @@ private:
     SDL_Event event;
 
     uint64_t prev_render;
+
+    // RGB332 staging buffer for the texture
     uint8_t* pixel_buffer = nullptr;
-    bool key_pressed[16] = { 0 };
 
-    const Key_Lut KEY_MAP = {
-        { SDLK_1, 0x1 }, { SDLK_2, 0x2 }, { SDLK_3, 0x3 }, { SDLK_4, 0xC },
-        { SDLK_q, 0x4 }, { SDLK_w, 0x5 }, { SDLK_e, 0x6 }, { SDLK_r, 0xD },
-        { SDLK_a, 0x7 }, { SDLK_s, 0x8 }, { SDLK_d, 0x9 }, { SDLK_f, 0xE },
-        { SDLK_z, 0xA }, { SDLK_x, 0x0 }, { SDLK_c, 0xB }, { SDLK_v, 0xF }
-    };
+    // the window was uncovered or resized and has to be presented again
+    bool exposed = true;
+
+    // chip-8 key state, a bit per key
+    uint16_t keys = 0;
+
+    // what every physical key does, indexed by scancode so the layout
+    // doesn't move with the keyboard language
+    static const uint8_t UNBOUND = 0xFF;
+    static const uint8_t QUIT = 0xFE;
+    static const uint8_t REWIND = 0xFD;
+    uint8_t bindings[SDL_NUM_SCANCODES];
+
+    // user event pushed by wake()
+    Uint32 wake_event = 0;
 
 
 // -- Helper functions
     // Initializes and reports errors for setting up SDL
     bool init_sdl();
 
+    // Expand rows first..last of the packed framebuffer into pixel_buffer
+    void unpack(const Framebuffer& frame, int first, int last);
+
     // Free up SDL resources
     void close_sdl();
 
+    // Apply one event to the window and key state
+    void handle(const SDL_Event& e);
+
 public:
-    bool running = true;
+    // rewind hotkey (backspace) is held down
+    bool rewinding = false;
 
 // -- Ctor/dtor
     Window();
     ~Window();
 
 // -- Functions
-    // Turn a single pixel on or off
-    void set_pixel(int x, int y, bool on);
+    // Render a frame on to the screen, uploading only the rows that changed
+    // and doing nothing at all when none did
+    void render(const Framebuffer& frame) override;
 
-    // Check the state of a pixel
-    bool get_pixel(int x, int y);
-
-    // Clear the entire screen
-    void clear_pixels();
+    // poll events
+    void poll() override;
 
-    // Render the current state of the texture on to the screen
-    void render();
+    // sleep until an event arrives or timeout_ms pass, then handle every
+    // pending event
+    void wait(int timeout_ms);
 
-    // poll events
-    void poll();
-    uint8_t await_keypress();
+    // interrupt wait() from another thread
+    void wake();
 
     // check if key has been pressed
-    bool get_key_press(int idx);
+    bool get_key_press(int idx) override;
+
+    // every chip-8 key as a bit
+    uint16_t key_mask() const;
+
+    // map chip-8 keys 0 through F to the keys named by layout, 16 letters or
+    // digits like KEY_LAYOUT. False if layout isn't usable.
+    bool set_layout(const char* layout);
 };
\ No newline at end of file
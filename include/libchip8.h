@@ -0,0 +1,100 @@
+#ifndef LIBCHIP8_H
+#define LIBCHIP8_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * C interface to the emulator core for embedding: no SDL, no window, no
+ * wall clock. Instances don't share anything another one's stepping
+ * touches, so different threads may step disjoint sets of them at once. Only what is declared here is exported
+ * from libchip8.so, and it only ever grows: CHIP8_API_VERSION is bumped
+ * when something is added.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__)
+#define CHIP8_API __attribute__((visibility("default")))
+#else
+#define CHIP8_API
+#endif
+
+#define CHIP8_API_VERSION 2
+
+/* the screen: CHIP8_HEIGHT rows of one 64-bit word, x = 0 in the most
+   significant bit */
+#define CHIP8_WIDTH 64
+#define CHIP8_HEIGHT 32
+
+enum chip8_platform { CHIP8_VIP, CHIP8_SCHIP, CHIP8_MODERN };
+
+enum chip8_engine { CHIP8_INTERPRETER, CHIP8_CACHED, CHIP8_JIT, CHIP8_THREADED };
+
+typedef struct chip8 chip8;
+
+/* -- Instances */
+
+/* CHIP8_API_VERSION of the library actually loaded */
+CHIP8_API int chip8_version(void);
+
+/* a machine at power-on with rom copied in at 0x200, NULL if rom is NULL,
+   empty or too large or memory runs out */
+CHIP8_API chip8* chip8_create(const uint8_t* rom, size_t size);
+
+/* n machines like chip8_create, written to out, their states packed side by
+   side in one block so stepping them walks memory in order. Returns 0, or
+   -1 having created none. Since version 2. */
+CHIP8_API int chip8_create_many(const uint8_t* rom, size_t size, chip8** out, size_t n);
+
+CHIP8_API void chip8_destroy(chip8* c);
+
+/* replace the rom and go back to power-on, keeping the settings. Returns 0,
+   or -1 and leaves the machine as it was if rom is NULL or doesn't fit. */
+CHIP8_API int chip8_load(chip8* c, const uint8_t* rom, size_t size);
+
+/* back to power-on with a fresh rng seed */
+CHIP8_API void chip8_reset(chip8* c, uint64_t seed);
+
+/* dst becomes an exact copy of src's machine, rng and screen included. Its
+   settings, keys and the rom chip8_reset goes back to stay its own. Since
+   version 2. */
+CHIP8_API void chip8_clone(chip8* dst, const chip8* src);
+
+/* -- Settings */
+
+/* quirk profile, CHIP8_VIP by default */
+CHIP8_API void chip8_set_platform(chip8* c, int platform);
+
+/* instructions per 60hz frame, 16 by default */
+CHIP8_API void chip8_set_ipf(chip8* c, int ipf);
+
+/* CHIP8_CACHED by default */
+CHIP8_API void chip8_set_engine(chip8* c, int engine);
+
+/* -- Stepping */
+
+/* advance each of n instances by frames frames, holding the keys in
+   actions[i] (bit k for key k) on instance i; actions may be NULL for no
+   keys */
+CHIP8_API void chip8_step_frames(chip8* const* instances, size_t n, const uint16_t* actions, int frames);
+
+/* -- Observations */
+
+/* the screen as CHIP8_HEIGHT words, read in place. The pointer stays valid
+   until chip8_load() or chip8_destroy(). */
+CHIP8_API const uint64_t* chip8_framebuffer(const chip8* c);
+
+/* frames completed since power-on */
+CHIP8_API uint64_t chip8_frames(const chip8* c);
+
+/* nonzero while the beeper sounds */
+CHIP8_API int chip8_sound(const chip8* c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
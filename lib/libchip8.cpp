@@ -0,0 +1,176 @@
+#include <memory>
+#include <new>
+#include <vector>
+#include "Arena.h"
+#include "Chip8.h"
+#include "Headless.h"
+#include "libchip8.h"
+
+// one instance: the host it reads keys from, its slot in an arena shared
+// with the instances created alongside it, and the engine running on that
+// slot. The arena's image is the power-on state reset goes back to.
+struct chip8 {
+    Headless host;
+    std::shared_ptr<Arena> arena;
+    size_t slot = 0;
+    std::unique_ptr<Chip8> chip;
+
+    Platform platform = VIP;
+    int ipf = 16;
+    Chip8::Engine engine = Chip8::CACHED;
+};
+
+// -- Instances
+
+int chip8_version(void) {
+    return CHIP8_API_VERSION;
+}
+
+// the power-on state of a rom, false if it doesn't fit
+static bool power_on(const uint8_t* rom, size_t size, State& out) {
+    if (rom == nullptr) {
+        return false;
+    }
+    // nothing may throw across the C boundary: a bad rom, which the core has
+    // already described on stderr, or running out of memory
+    try {
+        Headless host;
+        Chip8 chip(host, rom, size);
+        chip.snapshot(out);
+    } catch (...) {
+        return false;
+    }
+    return true;
+}
+
+// run c on slot of arena with its current settings
+static void bind(chip8* c, const std::shared_ptr<Arena>& arena, size_t slot) {
+    c->chip.reset(new Chip8(c->host, (*arena)[slot]));
+    c->arena = arena;
+    c->slot = slot;
+    c->chip->set_ipf(c->ipf);
+    c->chip->set_platform(c->platform);
+}
+
+chip8* chip8_create(const uint8_t* rom, size_t size) {
+    chip8* c;
+    if (chip8_create_many(rom, size, &c, 1) != 0) {
+        return nullptr;
+    }
+    return c;
+}
+
+int chip8_create_many(const uint8_t* rom, size_t size, chip8** out, size_t n) {
+    std::unique_ptr<State> image(new (std::nothrow) State());
+    if (out == nullptr || image == nullptr || !power_on(rom, size, *image)) {
+        return -1;
+    }
+
+    try {
+        std::shared_ptr<Arena> arena = std::make_shared<Arena>(*image, n);
+        std::vector<std::unique_ptr<chip8>> made(n);
+        for (size_t i = 0; i < n; i++) {
+            made[i].reset(new chip8());
+            bind(made[i].get(), arena, i);
+        }
+        for (size_t i = 0; i < n; i++) {
+            out[i] = made[i].release();
+        }
+    } catch (...) {
+        return -1;
+    }
+    return 0;
+}
+
+void chip8_destroy(chip8* c) {
+    delete c;
+}
+
+int chip8_load(chip8* c, const uint8_t* rom, size_t size) {
+    std::unique_ptr<State> image(new (std::nothrow) State());
+    if (image == nullptr || !power_on(rom, size, *image)) {
+        return -1;
+    }
+
+    // the new rom gets an arena of its own, the old one stays with the
+    // instances still sharing it
+    try {
+        bind(c, std::make_shared<Arena>(*image, 1), 0);
+    } catch (...) {
+        return -1;
+    }
+    return 0;
+}
+
+void chip8_reset(chip8* c, uint64_t seed) {
+    c->arena->reset(c->slot);
+    c->chip->reload();
+    c->chip->seed(seed);
+}
+
+void chip8_clone(chip8* dst, const chip8* src) {
+    if (dst == src) {
+        return;
+    }
+    if (dst->arena == src->arena) {
+        dst->arena->clone(dst->slot, src->slot);
+    } else {
+        (*dst->arena)[dst->slot] = (*src->arena)[src->slot];
+    }
+    dst->chip->reload();
+}
+
+// -- Settings
+
+void chip8_set_platform(chip8* c, int platform) {
+    switch (platform) {
+    case CHIP8_VIP: c->platform = VIP; break;
+    case CHIP8_SCHIP: c->platform = SUPER_CHIP; break;
+    case CHIP8_MODERN: c->platform = MODERN; break;
+    default: return;
+    }
+    c->chip->set_platform(c->platform);
+}
+
+void chip8_set_ipf(chip8* c, int ipf) {
+    c->ipf = ipf;
+    c->chip->set_ipf(ipf);
+}
+
+void chip8_set_engine(chip8* c, int engine) {
+    switch (engine) {
+    case CHIP8_INTERPRETER: c->engine = Chip8::INTERPRETER; break;
+    case CHIP8_CACHED: c->engine = Chip8::CACHED; break;
+    case CHIP8_JIT: c->engine = Chip8::JIT; break;
+    case CHIP8_THREADED: c->engine = Chip8::THREADED; break;
+    }
+}
+
+// -- Stepping
+
+void chip8_step_frames(chip8* const* instances, size_t n, const uint16_t* actions, int frames) {
+    for (size_t i = 0; i < n; i++) {
+        chip8* c = instances[i];
+        uint16_t keys = actions != nullptr ? actions[i] : 0;
+        for (int k = 0; k < 16; k++) {
+            c->host.set_key(k, (keys >> k) & 0x1);
+        }
+        for (int f = 0; f < frames; f++) {
+            c->chip->run_frame(c->engine);
+        }
+    }
+}
+
+// -- Observations
+
+const uint64_t* chip8_framebuffer(const chip8* c) {
+    return c->chip->framebuffer().rows;
+}
+
+uint64_t chip8_frames(const chip8* c) {
+    return c->chip->frame_count();
+}
+
+int chip8_sound(const chip8* c) {
+    return c->chip->registers().reg_s > 0;
+}
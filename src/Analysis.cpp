@@ -0,0 +1,426 @@
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include "Analysis.h"
+
+// how an instruction leaves straight-line code
+enum Exit { FALL, JUMP, CALL, SKIP, RETURN, INDIRECT };
+
+static Exit exit_of(uint16_t instr) {
+    switch (instr >> 12) {
+    case 0x0: return instr == 0x00EE ? RETURN : FALL;
+    case 0x1: return JUMP;
+    case 0x2: return CALL;
+    case 0x3:
+    case 0x4: return SKIP;
+    case 0x5:
+    case 0x9: return (instr & 0xF) == 0 ? SKIP : FALL;
+    case 0xB: return INDIRECT;
+    case 0xE: return ((instr & 0xFF) == 0x9E || (instr & 0xFF) == 0xA1) ? SKIP : FALL;
+    }
+    return FALL;
+}
+
+// value of I at a point: not reached yet, one known address, or anything
+struct Reg_I {
+    enum { UNSET, KNOWN, ANY } kind = UNSET;
+    uint16_t value = 0;
+
+    // combine the values coming in from two paths
+    bool merge(const Reg_I& other) {
+        if (other.kind == UNSET || kind == ANY) {
+            return false;
+        }
+        if (kind == UNSET) {
+            *this = other;
+            return true;
+        }
+        if (other.kind == ANY || other.value != value) {
+            kind = ANY;
+            return true;
+        }
+        return false;
+    }
+};
+
+Analysis::Analysis(const std::vector<uint8_t>& rom) {
+    size_t size = std::min<size_t>(rom.size(), 4096 - 0x200);
+    memcpy(&memory[0x200], rom.data(), size);
+    rom_end = 0x200 + size;
+
+    explore();
+    build_blocks();
+    track_i();
+    build_calls();
+}
+
+Analysis::~Analysis() {}
+
+uint16_t Analysis::instr_at(uint16_t addr) const {
+    return memory[addr & 0xFFF] << 8 | memory[(addr + 1) & 0xFFF];
+}
+
+// -- Passes
+
+void Analysis::explore() {
+    std::vector<uint16_t> work = { 0x200 };
+    flags[0x200] |= LEADER | ENTRY;
+
+    // a new leader to visit
+    auto branch = [&](uint16_t addr) {
+        flags[addr & 0xFFF] |= LEADER;
+        work.push_back(addr & 0xFFF);
+    };
+
+    while (!work.empty()) {
+        uint16_t addr = work.back();
+        work.pop_back();
+
+        while (addr + 1 < rom_end) {
+            // ran into code seen before, which now has two ways in
+            if (flags[addr] & CODE) {
+                flags[addr] |= LEADER;
+                break;
+            }
+            flags[addr] |= CODE;
+            flags[addr + 1] |= OPERAND;
+            uint16_t instr = instr_at(addr);
+            uint16_t nnn = instr & 0xFFF;
+
+            Exit exit = exit_of(instr);
+            if (exit == JUMP) {
+                branch(nnn);
+                break;
+            } else if (exit == CALL) {
+                flags[nnn] |= ENTRY;
+                branch(nnn);
+                branch(addr + 2);
+                break;
+            } else if (exit == SKIP) {
+                branch(addr + 2);
+                branch(addr + 4);
+                break;
+            } else if (exit == RETURN) {
+                break;
+            } else if (exit == INDIRECT) {
+                indirect_jumps.push_back(addr);
+                break;
+            }
+            addr += 2;
+        }
+    }
+
+    std::sort(indirect_jumps.begin(), indirect_jumps.end());
+}
+
+void Analysis::build_blocks() {
+    for (int start = 0; start < 4096; start++) {
+        if ((flags[start] & (LEADER | CODE)) != (LEADER | CODE)) {
+            continue;
+        }
+
+        Block block;
+        block.start = start;
+        uint16_t addr = start;
+        while (true) {
+            uint16_t instr = instr_at(addr);
+            Exit exit = exit_of(instr);
+            uint16_t next = addr + 2;
+
+            if (exit == JUMP) {
+                block.next.push_back(instr & 0xFFF);
+            } else if (exit == CALL) {
+                block.call = instr & 0xFFF;
+                block.next.push_back(next);
+            } else if (exit == SKIP) {
+                block.next.push_back(next);
+                block.next.push_back(next + 2);
+            } else if (exit == RETURN) {
+                block.returns = true;
+            } else if (exit == INDIRECT) {
+                block.indirect = true;
+            } else if (next + 1 >= rom_end) {
+                block.falls_off = true;
+            } else if (flags[next] & LEADER) {
+                block.next.push_back(next);
+            } else {
+                addr = next;
+                continue;
+            }
+            block.end = next;
+            break;
+        }
+        blocks.push_back(block);
+    }
+}
+
+void Analysis::track_i() {
+    // I on entry to every block; calls and the entry point start unknown
+    std::map<uint16_t, Reg_I> in;
+    Reg_I any;
+    any.kind = Reg_I::ANY;
+    in[0x200] = any;
+    for (const Block& block : blocks) {
+        if (block.call != 0) {
+            in[block.call] = any;
+            // the callee may have moved I
+            in[block.end] = any;
+        }
+    }
+
+    // I after running a block from a given I; report marks data and stores
+    auto run = [&](const Block& block, Reg_I i, bool report) {
+        for (uint16_t addr = block.start; addr < block.end; addr += 2) {
+            uint16_t instr = instr_at(addr);
+            uint8_t x = (instr >> 8) & 0xF;
+            int reads = 0;
+            int writes = 0;
+
+            if ((instr >> 12) == 0xA) {
+                i.kind = Reg_I::KNOWN;
+                i.value = instr & 0xFFF;
+                continue;
+            } else if ((instr >> 12) == 0xD) {
+                reads = instr & 0xF;
+            } else if ((instr >> 12) == 0xF) {
+                switch (instr & 0xFF) {
+                case 0x1E:
+                case 0x29:
+                    i.kind = Reg_I::ANY;
+                    break;
+                case 0x33:
+                    writes = 3;
+                    break;
+                case 0x55:
+                    writes = x + 1;
+                    break;
+                case 0x65:
+                    reads = x + 1;
+                    break;
+                }
+            }
+
+            if (report && i.kind == Reg_I::KNOWN) {
+                for (int b = 0; b < reads; b++) {
+                    flags[(i.value + b) & 0xFFF] |= DATA;
+                }
+                bool hits_code = false;
+                for (int b = 0; b < writes; b++) {
+                    uint8_t& f = flags[(i.value + b) & 0xFFF];
+                    f |= WRITTEN;
+                    hits_code |= (f & (CODE | OPERAND)) != 0;
+                }
+                if (hits_code) {
+                    self_modifying.push_back(addr);
+                }
+            } else if (report && writes > 0) {
+                unresolved_stores.push_back(addr);
+            }
+
+            // FX55/FX65 may or may not advance I depending on the platform
+            if ((instr & 0xF0FF) == 0xF055 || (instr & 0xF0FF) == 0xF065) {
+                i.kind = Reg_I::ANY;
+            }
+        }
+        return i;
+    };
+
+    // iterate to a fixed point, blocks are few
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (const Block& block : blocks) {
+            auto entry = in.find(block.start);
+            if (entry == in.end()) {
+                continue;
+            }
+            Reg_I out = run(block, entry->second, false);
+            for (uint16_t next : block.next) {
+                changed |= in[next].merge(out);
+            }
+        }
+    }
+
+    for (const Block& block : blocks) {
+        auto entry = in.find(block.start);
+        run(block, entry != in.end() ? entry->second : any, true);
+    }
+}
+
+void Analysis::build_calls() {
+    for (const Block& entry : blocks) {
+        if (!(flags[entry.start] & ENTRY)) {
+            continue;
+        }
+
+        // every block reachable without following a call
+        std::set<uint16_t> seen = { entry.start };
+        std::set<uint16_t> callees;
+        std::vector<uint16_t> work = { entry.start };
+        while (!work.empty()) {
+            const Block* block = block_at(work.back());
+            work.pop_back();
+            if (block == nullptr) {
+                continue;
+            }
+            if (block->call != 0) {
+                callees.insert(block->call);
+            }
+            for (uint16_t next : block->next) {
+                if (seen.insert(next).second) {
+                    work.push_back(next);
+                }
+            }
+        }
+        calls[entry.start].assign(callees.begin(), callees.end());
+    }
+}
+
+// -- Functions
+
+const Analysis::Block* Analysis::block_at(uint16_t addr) const {
+    auto it = std::lower_bound(blocks.begin(), blocks.end(), addr,
+        [](const Block& b, uint16_t a) { return b.start < a; });
+    if (it == blocks.end() || it->start != addr) {
+        return nullptr;
+    }
+    return &*it;
+}
+
+std::string Analysis::disassemble(uint16_t instr) {
+    std::ostringstream out;
+    out << std::uppercase << std::hex;
+    int x = (instr >> 8) & 0xF;
+    int y = (instr >> 4) & 0xF;
+    int n = instr & 0xF;
+    int nn = instr & 0xFF;
+    int nnn = instr & 0xFFF;
+
+    switch (instr >> 12) {
+    case 0x0:
+        if (instr == 0x00E0) out << "CLS";
+        else if (instr == 0x00EE) out << "RET";
+        else out << "SYS 0x" << nnn;
+        return out.str();
+    case 0x1: out << "JP 0x" << nnn; return out.str();
+    case 0x2: out << "CALL 0x" << nnn; return out.str();
+    case 0x3: out << "SE V" << x << ", 0x" << nn; return out.str();
+    case 0x4: out << "SNE V" << x << ", 0x" << nn; return out.str();
+    case 0x5:
+        if (n == 0) {
+            out << "SE V" << x << ", V" << y;
+            return out.str();
+        }
+        break;
+    case 0x6: out << "LD V" << x << ", 0x" << nn; return out.str();
+    case 0x7: out << "ADD V" << x << ", 0x" << nn; return out.str();
+    case 0x8: {
+        static const char* const ALU[16] = {
+            "LD", "OR", "AND", "XOR", "ADD", "SUB", "SHR", "SUBN",
+            nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, "SHL", nullptr
+        };
+        if (ALU[n] != nullptr) {
+            out << ALU[n] << " V" << x << ", V" << y;
+            return out.str();
+        }
+        break;
+    }
+    case 0x9:
+        if (n == 0) {
+            out << "SNE V" << x << ", V" << y;
+            return out.str();
+        }
+        break;
+    case 0xA: out << "LD I, 0x" << nnn; return out.str();
+    case 0xB: out << "JP V0, 0x" << nnn; return out.str();
+    case 0xC: out << "RND V" << x << ", 0x" << nn; return out.str();
+    case 0xD: out << "DRW V" << x << ", V" << y << ", " << n; return out.str();
+    case 0xE:
+        if (nn == 0x9E) { out << "SKP V" << x; return out.str(); }
+        if (nn == 0xA1) { out << "SKNP V" << x; return out.str(); }
+        break;
+    case 0xF:
+        switch (nn) {
+        case 0x07: out << "LD V" << x << ", DT"; return out.str();
+        case 0x0A: out << "LD V" << x << ", K"; return out.str();
+        case 0x15: out << "LD DT, V" << x; return out.str();
+        case 0x18: out << "LD ST, V" << x; return out.str();
+        case 0x1E: out << "ADD I, V" << x; return out.str();
+        case 0x29: out << "LD F, V" << x; return out.str();
+        case 0x33: out << "LD B, V" << x; return out.str();
+        case 0x55: out << "LD [I], V" << x; return out.str();
+        case 0x65: out << "LD V" << x << ", [I]"; return out.str();
+        }
+        break;
+    }
+    out << "DW 0x" << std::setw(4) << std::setfill('0') << instr;
+    return out.str();
+}
+
+void Analysis::print(std::ostream& out) const {
+    out << std::hex << std::setfill('0');
+    out << "; rom 0x200-0x" << rom_end << ", " << std::dec << blocks.size() << " blocks, " << calls.size() << " functions\n";
+    for (const auto& fn : calls) {
+        out << "; sub_" << std::hex << fn.first << " calls";
+        for (uint16_t callee : fn.second) {
+            out << " sub_" << callee;
+        }
+        out << (fn.second.empty() ? " nothing\n" : "\n");
+    }
+    for (uint16_t addr : indirect_jumps) {
+        out << "; indirect jump at 0x" << addr << "\n";
+    }
+    for (uint16_t addr : self_modifying) {
+        out << "; store into code at 0x" << addr << "\n";
+    }
+    for (uint16_t addr : unresolved_stores) {
+        out << "; store through unknown I at 0x" << addr << "\n";
+    }
+
+    // walk the rom in address order: blocks, then data and unreached bytes
+    uint16_t addr = 0x200;
+    while (addr < rom_end) {
+        const Block* block = block_at(addr);
+        if (block != nullptr) {
+            out << "\n";
+            if (flags[addr] & ENTRY) {
+                out << "sub_" << addr << ":\n";
+            }
+            out << "block_" << addr << ":";
+            if (!block->next.empty()) {
+                out << "  ; ->";
+                for (uint16_t next : block->next) {
+                    out << " 0x" << std::setw(3) << next;
+                }
+            }
+            out << (block->returns ? "  ; returns" : "") << (block->indirect ? "  ; indirect" : "");
+            out << (block->falls_off ? "  ; runs off the rom" : "") << "\n";
+
+            for (uint16_t a = block->start; a < block->end; a += 2) {
+                uint16_t instr = instr_at(a);
+                out << "  0x" << std::setw(3) << a << "  " << std::setw(4) << instr << "  " << disassemble(instr) << "\n";
+            }
+            addr = block->end;
+            continue;
+        }
+
+        if (flags[addr] & (CODE | OPERAND)) {
+            // second half of an instruction reached at an odd address
+            addr++;
+            continue;
+        }
+
+        // data read as sprites shows as pixels
+        const char* kind = (flags[addr] & DATA) ? "data" : (flags[addr] & WRITTEN) ? "store" : "unreached";
+        out << "  0x" << std::setw(3) << addr << "  " << std::setw(2) << int(memory[addr]) << "    ";
+        for (int bit = 7; bit >= 0; bit--) {
+            out << (((memory[addr] >> bit) & 0x1) ? '#' : '.');
+        }
+        out << "  ; " << kind << "\n";
+        addr++;
+    }
+    out << std::dec << std::setfill(' ') << std::flush;
+}
@@ -0,0 +1,47 @@
+#include <dlfcn.h>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include "Aot.h"
+
+Aot::Aot(const char* fpath, uint64_t rom_hash, Platform platform) {
+    handle = dlopen(fpath, RTLD_NOW | RTLD_LOCAL);
+    if (handle == nullptr) {
+        std::cerr << "Note: " << dlerror() << "\n";
+        return;
+    }
+
+    typedef const Aot_Module* (*Entry)();
+    Entry entry = reinterpret_cast<Entry>(dlsym(handle, "chip8_aot_module"));
+    const Aot_Module* found = entry != nullptr ? entry() : nullptr;
+
+    if (found == nullptr || found->abi != AOT_ABI || found->state_size != sizeof(State)) {
+        std::cerr << "Note: " << fpath << " was built by another version of chip8-aot\n";
+    } else if (found->rom_hash != rom_hash || found->platform != uint32_t(platform)) {
+        std::cerr << "Note: " << fpath << " was built for another rom or platform\n";
+    } else {
+        module = found;
+        return;
+    }
+
+    dlclose(handle);
+    handle = nullptr;
+}
+
+Aot::~Aot() {
+    if (handle != nullptr) {
+        dlclose(handle);
+        handle = nullptr;
+    }
+}
+
+bool Aot::available() const {
+    return module != nullptr;
+}
+
+std::string Aot::file_name(uint64_t rom_hash, Platform platform) {
+    static const char* names[] = { "vip", "schip", "modern" };
+    std::ostringstream name;
+    name << std::hex << std::setw(16) << std::setfill('0') << rom_hash << "-" << names[platform] << ".so";
+    return name.str();
+}
@@ -0,0 +1,38 @@
+#include <cstring>
+#include "Arena.h"
+
+Arena::Arena(const State& image, size_t count) : states(count, image), image(image) {}
+
+Arena::~Arena() {}
+
+size_t Arena::add(size_t count) {
+    size_t first = states.size();
+    states.resize(first + count, image);
+    return first;
+}
+
+size_t Arena::size() const {
+    return states.size();
+}
+
+State& Arena::operator[](size_t i) {
+    return states[i];
+}
+
+const State& Arena::operator[](size_t i) const {
+    return states[i];
+}
+
+const State& Arena::power_on() const {
+    return image;
+}
+
+void Arena::reset(size_t i) {
+    memcpy(&states[i], &image, sizeof(State));
+}
+
+void Arena::clone(size_t to, size_t from) {
+    if (to != from) {
+        memcpy(&states[to], &states[from], sizeof(State));
+    }
+}
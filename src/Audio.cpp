@@ -0,0 +1,87 @@
+#include <iostream>
+#include "Audio.h"
+
+Audio::Audio(int ipf) {
+    SDL_AudioSpec want;
+    SDL_AudioSpec have;
+    SDL_zero(want);
+    want.freq = AUDIO_FREQ;
+    want.format = AUDIO_S16SYS;
+    want.channels = 1;
+    want.samples = AUDIO_SAMPLES;
+    want.callback = Audio::callback;
+    want.userdata = this;
+
+    device = SDL_OpenAudioDevice(nullptr, 0, &want, &have, 0);
+    if (device == 0) {
+        std::cerr << "Error: SDL audio device could not be opened, sound is off\n";
+        return;
+    }
+
+    cycles_per_sample = 60.0 * ipf / have.freq;
+    frame = ipf;
+    period = have.freq / AUDIO_TONE;
+
+    // start playing (silence until the first edge)
+    SDL_PauseAudioDevice(device, 0);
+}
+
+Audio::~Audio() {
+    if (device != 0) {
+        SDL_CloseAudioDevice(device);
+        device = 0;
+    }
+}
+
+bool Audio::available() const {
+    return device != 0;
+}
+
+// -- Core thread
+
+void Audio::push(bool on, uint64_t cycle) {
+    uint32_t h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) == RING_SIZE) {
+        return;
+    }
+
+    ring[h & (RING_SIZE - 1)] = { cycle, on };
+    head.store(h + 1, std::memory_order_release);
+}
+
+// -- Audio thread
+
+void Audio::callback(void* self, Uint8* stream, int len) {
+    static_cast<Audio*>(self)->fill(reinterpret_cast<int16_t*>(stream), len / 2);
+}
+
+void Audio::fill(int16_t* out, int count) {
+    uint32_t t = tail.load(std::memory_order_relaxed);
+    uint32_t h = head.load(std::memory_order_acquire);
+
+    // the core ran ahead, stalled or was rewound: hold the next edge one
+    // frame away so the edges after it keep their spacing
+    if (t != h) {
+        double next = double(ring[t & (RING_SIZE - 1)].cycle);
+        if (next > clock + 3 * frame || next + 3 * frame < clock) {
+            clock = next - frame;
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        while (t != h && double(ring[t & (RING_SIZE - 1)].cycle) <= clock) {
+            on = ring[t & (RING_SIZE - 1)].on;
+            t++;
+        }
+
+        if (on) {
+            out[i] = phase < period / 2 ? AUDIO_VOLUME : -AUDIO_VOLUME;
+            phase = phase + 1 < period ? phase + 1 : 0;
+        } else {
+            out[i] = 0;
+        }
+        clock += cycles_per_sample;
+    }
+
+    tail.store(t, std::memory_order_release);
+}
@@ -0,0 +1,115 @@
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include "Batch.h"
+
+Batch::Instance::Instance(const std::vector<uint8_t>& rom, uint64_t seed, int ipf) :
+    chip(host, rom.data(), rom.size()) {
+    chip.seed(seed);
+    chip.set_ipf(ipf);
+}
+
+Batch::Batch(unsigned threads, Chip8::Engine engine, int ipf) : threads(threads), engine(engine), ipf(ipf) {
+    if (this->threads == 0) {
+        this->threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+}
+
+Batch::~Batch() {}
+
+void Batch::attach(const Aot* code) {
+    aot = code;
+    for (std::unique_ptr<Instance>& inst : instances) {
+        inst->chip.attach(aot);
+    }
+}
+
+size_t Batch::add(const std::vector<uint8_t>& rom, uint64_t seed) {
+    instances.emplace_back(new Instance(rom, seed, ipf));
+    if (aot != nullptr) {
+        instances.back()->chip.attach(aot);
+    }
+    return instances.size() - 1;
+}
+
+std::vector<Batch::Result> Batch::run(uint64_t budget) {
+    unsigned count = std::min<size_t>(threads, instances.size());
+    std::vector<Queue> queues(count);
+
+    // deal the machines out round robin
+    for (size_t i = 0; i < instances.size(); i++) {
+        queues[i % count].tasks.push_back(i);
+    }
+
+    std::vector<std::thread> workers;
+    for (unsigned id = 0; id < count; id++) {
+        workers.emplace_back(&Batch::worker, this, std::ref(queues), id, budget);
+    }
+    for (std::thread& t : workers) {
+        t.join();
+    }
+
+    std::vector<Result> results(instances.size());
+    for (size_t i = 0; i < instances.size(); i++) {
+        results[i].hash = instances[i]->chip.framebuffer().hash();
+        results[i].cycles = instances[i]->cycles;
+        results[i].regs = instances[i]->chip.registers();
+    }
+    return results;
+}
+
+bool Batch::next_task(std::vector<Queue>& queues, unsigned id, size_t& task) {
+    {
+        std::lock_guard<std::mutex> guard(queues[id].lock);
+        if (!queues[id].tasks.empty()) {
+            task = queues[id].tasks.back();
+            queues[id].tasks.pop_back();
+            return true;
+        }
+    }
+
+    // nothing left locally, steal the oldest task from a neighbour
+    for (size_t i = 1; i < queues.size(); i++) {
+        Queue& victim = queues[(id + i) % queues.size()];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.tasks.empty()) {
+            task = victim.tasks.front();
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void Batch::worker(std::vector<Queue>& queues, unsigned id, uint64_t budget) {
+    size_t task;
+    while (next_task(queues, id, task)) {
+        Instance& inst = *instances[task];
+
+        // idle-skipped cycles count towards the budget, as in run_for()
+        uint64_t executed = 0;
+        uint64_t skipped = inst.chip.skipped();
+        while (executed + inst.chip.skipped() - skipped < budget) {
+            switch (engine) {
+            case Chip8::INTERPRETER: executed += inst.chip.run(); break;
+            case Chip8::CACHED: executed += inst.chip.run_cached(); break;
+            case Chip8::JIT: executed += inst.chip.run_jit(); break;
+            case Chip8::THREADED: executed += inst.chip.run_threaded(); break;
+            case Chip8::AOT: executed += inst.chip.run_aot(); break;
+            }
+        }
+        inst.cycles += executed + inst.chip.skipped() - skipped;
+    }
+}
+
+std::vector<uint8_t> Batch::load(const char* fpath) {
+    std::ifstream istream(fpath, std::ios::binary);
+
+    if (!istream) {
+        std::cerr << "Error: Failed to open file " << fpath << "\n";
+        throw - 2;
+    }
+
+    return std::vector<uint8_t>(std::istreambuf_iterator<char>(istream), std::istreambuf_iterator<char>());
+}
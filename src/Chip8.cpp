@@ -1,7 +1,12 @@
-#include <cstdlib>
+#include <algorithm>
+#include <cstring>
+#include "Analysis.h"
+#include "Aot.h"
 #include "Chip8.h"
 
-Chip8::Chip8(Window& w, uint64_t& t, const char* fpath) : window(w), time(t) {
+Chip8::Chip8(Host& h, const char* fpath) : owned(new State()), s(*owned), host(h) {
+    s.reset();
+
     // open file to end
     std::ifstream istream(fpath, std::ios::binary | std::ios::ate);
 
@@ -18,7 +23,7 @@ Chip8::Chip8(Window& w, uint64_t& t, const char* fpath) : window(w), time(t) {
         throw - 3;
     }
 
-    if (file_size > static_cast<std::streamsize>(sizeof(memory) - 0x200)) {
+    if (file_size > static_cast<std::streamsize>(sizeof(s.memory) - 0x200)) {
         std::cerr << "Error: File size (" << file_size << ") too large to fit into memory\n";
         throw - 4;
     }
@@ -27,7 +32,7 @@ Chip8::Chip8(Window& w, uint64_t& t, const char* fpath) : window(w), time(t) {
     istream.seekg(0, std::ios::beg);
 
     // Read directly into memory starting from 0x200
-    istream.read(reinterpret_cast<char*>(&memory[0x200]), file_size);
+    istream.read(reinterpret_cast<char*>(&s.memory[0x200]), file_size);
 
     if (!istream) {
         std::cerr << "Error: Failed to read entire file\n";
@@ -35,48 +40,713 @@ Chip8::Chip8(Window& w, uint64_t& t, const char* fpath) : window(w), time(t) {
     }
 
     // Reset PC
-    pc = 0x200;
+    s.pc = 0x200;
+
+    // nothing decoded yet
+    invalidate_all();
+}
+
+Chip8::Chip8(Host& h, const uint8_t* rom, size_t size) : owned(new State()), s(*owned), host(h) {
+    s.reset();
+
+    if (size == 0) {
+        std::cerr << "Error: Rom is empty\n";
+        throw - 3;
+    }
+
+    if (size > sizeof(s.memory) - 0x200) {
+        std::cerr << "Error: Rom size (" << size << ") too large to fit into memory\n";
+        throw - 4;
+    }
+
+    memcpy(&s.memory[0x200], rom, size);
+
+    // Reset PC
+    s.pc = 0x200;
+
+    // nothing decoded yet
+    invalidate_all();
+}
+
+Chip8::Chip8(Host& h, State& state) : s(state), host(h) {
+    reload();
 }
 
 Chip8::~Chip8() {}
 
+void Chip8::seed(uint64_t value) {
+    s.rng_state = value;
+}
+
+void Chip8::set_ipf(int instructions) {
+    ipf = instructions > 0 ? instructions : 1;
+}
+
+void Chip8::set_platform(Platform p) {
+    platform = p;
+    switch (platform) {
+    case VIP: decoder = exec_decode<Vip>; break;
+    case SUPER_CHIP: decoder = exec_decode<SuperChip>; break;
+    case MODERN: decoder = exec_decode<Modern>; break;
+    }
+
+    // compiled code has the old quirks baked in
+    jit.reset();
+    invalidate_all();
+}
+
+void Chip8::set_idle_skip(bool enabled) {
+    idle_skip = enabled;
+}
+
+void Chip8::set_cycle_skip(uint64_t horizon) {
+    cycle_horizon = horizon;
+}
+
+uint64_t Chip8::skipped() const {
+    return cycles_skipped;
+}
+
+uint64_t Chip8::frame_count() const {
+    return s.frames;
+}
+
+Chip8::Registers Chip8::registers() const {
+    Registers regs;
+    regs.pc = s.pc;
+    regs.reg_i = s.reg_i;
+    regs.sp = s.sp;
+    memcpy(regs.reg_v, s.reg_v, sizeof(s.reg_v));
+    regs.reg_t = s.reg_t;
+    regs.reg_s = s.reg_s;
+    return regs;
+}
+
+const Framebuffer& Chip8::framebuffer() const {
+    return s.frame;
+}
+
+void Chip8::snapshot(State& out) const {
+    out = s;
+}
+
+void Chip8::restore(const State& in) {
+    s = in;
+    reload();
+}
+
+void Chip8::reload() {
+    // the screen jumped to another point in time
+    s.frame.dirty = ~0u;
+
+    // the last idle check belongs to another timeline
+    idle.frames = ~0ull;
+
+    // and so do the hashes seen so far
+    keys_since = s.cycles;
+    candidate_period = 0;
+
+    // memory may hold different code now
+    invalidate_all();
+}
+
 void Chip8::memory_dump() {
     for (int i = 0; i < 4096; i++) {
         if (i % 16 == 0)
             std::cout << "\n0x" << std::hex << i << ": ";
 
         if (i % 2 == 0)
-            std::cout << std::hex << int(memory[i]) << " ";
+            std::cout << std::hex << int(s.memory[i]) << " ";
         else
-            std::cout << std::hex << int(memory[i]) << "\t";
+            std::cout << std::hex << int(s.memory[i]) << "\t";
     }
     std::cout << std::dec << std::endl;
 }
 
-void Chip8::run() {
-    if (pc < 4096) {
+void Chip8::register_dump() {
+    std::cout << std::hex << "pc: 0x" << s.pc << " i: 0x" << s.reg_i << " sp: 0x" << int(s.sp);
+    std::cout << " t: 0x" << int(s.reg_t) << " s: 0x" << int(s.reg_s) << "\n";
+    for (int i = 0; i < 16; i++) {
+        std::cout << "v" << i << ": 0x" << int(s.reg_v[i]) << (i % 8 == 7 ? "\n" : "\t");
+    }
+    std::cout << std::dec << std::flush;
+}
+
+bool Chip8::same_state(const Chip8& other) const {
+    return s.pc == other.s.pc && s.sp == other.s.sp && s.reg_i == other.s.reg_i &&
+        s.reg_t == other.s.reg_t && s.reg_s == other.s.reg_s && s.rng_state == other.s.rng_state &&
+        memcmp(s.reg_v, other.s.reg_v, sizeof(s.reg_v)) == 0 &&
+        memcmp(s.stack, other.s.stack, sizeof(s.stack)) == 0 &&
+        memcmp(s.memory, other.s.memory, sizeof(s.memory)) == 0 &&
+        memcmp(s.frame.rows, other.s.frame.rows, sizeof(s.frame.rows)) == 0;
+}
+
+void Chip8::run_frame(Engine engine) {
+    uint64_t frame_start = s.frames;
+    while (s.frames == frame_start) {
+        switch (engine) {
+        case INTERPRETER: run(); break;
+        case CACHED: run_cached(); break;
+        case JIT: run_jit(); break;
+        case THREADED: run_threaded(); break;
+        case AOT: run_aot(); break;
+        }
+    }
+}
+
+int Chip8::run() {
+    NoProfile none;
+    return run(none);
+}
+
+int Chip8::run_cached(int count) {
+    NoProfile none;
+    return run_cached(count, none);
+}
+
+template <class P>
+void Chip8::run_frame(Engine engine, P& profile) {
+    uint64_t frame_start = s.frames;
+    while (s.frames == frame_start) {
+        if (engine == INTERPRETER) {
+            run(profile);
+        } else {
+            run_cached(0, profile);
+        }
+    }
+}
+
+template <class P>
+int Chip8::run(P& profile) {
+    switch (platform) {
+    case VIP: return run_as<Vip>(profile);
+    case SUPER_CHIP: return run_as<SuperChip>(profile);
+    case MODERN: return run_as<Modern>(profile);
+    }
+    return 0;
+}
+
+template <class Q, class P>
+int Chip8::run_as(P& profile) {
+    if (s.key_wait) {
+        return wait_key(1);
+    }
+
+    if (s.pc < 4096) {
         // get the instruction
-        uint16_t instr = memory[pc] << 8 | memory[pc + 1];
+        uint16_t instr = s.memory[s.pc] << 8 | s.memory[(s.pc + 1) & 0xFFF];
+        profile.instr(s.pc, instr);
 
         // auto increment the program counter
-        pc += 2;
+        s.pc += 2;
 
 
-        run_instr(instr);
+        run_instr<Q>(instr);
+    }
 
-        if (SDL_GetTicks64() - time >= 16) {
-            if (reg_t > 0) {
-                reg_t--;
-            }
-            if (reg_s > 0) {
-                reg_s--;
+    tick(1);
+    check_idle();
+    return 1;
+}
+
+template <class P>
+int Chip8::run_cached(int count, P& profile) {
+    int left = ipf - s.frame_cycles;
+    if (count <= 0) {
+        count = left;
+    }
+
+    if (s.key_wait) {
+        return wait_key(count);
+    }
+
+    // fused entries must not run past count or the end of the frame
+    int limit = std::min(count, left);
+    int done = 0;
+    while (done < count) {
+        // halted, time still passes
+        if (s.pc >= 4096) {
+            done = count;
+            break;
+        }
+        done += step_cached(profile, limit - done);
+
+        // leave at loop back-edges so idle detection sees them
+        if (idle_check) {
+            break;
+        }
+    }
+
+    tick(done);
+    check_idle();
+    return done;
+}
+
+template <class P>
+int Chip8::step_cached(P& profile, int budget) {
+    const Op& op = cache[s.pc];
+    uint16_t addr = s.pc;
+
+    // the cached entry may not be decoded yet, so read the raw instruction
+    profile.instr(addr, s.memory[addr] << 8 | s.memory[(addr + 1) & 0xFFF]);
+
+    // auto increment the program counter
+    s.pc += 2;
+
+    step_budget = budget;
+    step_fused = 0;
+    op.fn(*this, op);
+
+    // report the instructions a fused entry covered
+    for (int i = 1; i <= step_fused; i++) {
+        uint16_t next = (addr + 2 * i) & 0xFFF;
+        profile.instr(next, s.memory[next] << 8 | s.memory[(next + 1) & 0xFFF]);
+    }
+    profile.fused(addr, step_fused);
+
+    return 1 + step_fused;
+}
+
+template void Chip8::run_frame<NoProfile>(Engine, NoProfile&);
+template void Chip8::run_frame<Profiler>(Engine, Profiler&);
+template int Chip8::run<NoProfile>(NoProfile&);
+template int Chip8::run<Profiler>(Profiler&);
+template int Chip8::run_cached<NoProfile>(int, NoProfile&);
+template int Chip8::run_cached<Profiler>(int, Profiler&);
+template int Chip8::run_cached<Coverage>(int, Coverage&);
+
+void Chip8::start_jit() {
+    // tell the recompiler where everything lives in this machine
+    const uint8_t* base = reinterpret_cast<const uint8_t*>(&s);
+    Jit::Layout layout;
+    layout.pc = reinterpret_cast<const uint8_t*>(&s.pc) - base;
+    layout.reg_v = reinterpret_cast<const uint8_t*>(s.reg_v) - base;
+    layout.reg_i = reinterpret_cast<const uint8_t*>(&s.reg_i) - base;
+    layout.reg_t = &s.reg_t - base;
+    layout.reg_s = &s.reg_s - base;
+    layout.memory = s.memory - base;
+
+    Jit::Quirks quirks;
+    switch (platform) {
+    case VIP: quirks = jit_quirks<Vip>(); break;
+    case SUPER_CHIP: quirks = jit_quirks<SuperChip>(); break;
+    case MODERN: quirks = jit_quirks<Modern>(); break;
+    }
+    jit.reset(new Jit(layout, quirks));
+}
+
+int Chip8::run_jit() {
+    if (s.pc >= 4096) {
+        tick(1);
+        return 1;
+    }
+    if (s.key_wait) {
+        return wait_key(ipf - s.frame_cycles);
+    }
+
+    if (!jit) {
+        start_jit();
+    }
+
+    // blocks stop at the frame boundary, so the timers tick in between
+    int budget = ipf - s.frame_cycles;
+    int count = 1;
+    const Jit::Entry& block = jit->lookup(s.pc, s.memory);
+    if (block.fn != nullptr) {
+        count = block.fn(&s, budget);
+        idle_check |= block.loops && count == block.count;
+    } else {
+        // fall back to the interpreter
+        NoProfile none;
+        count = step_cached(none, budget);
+    }
+
+    tick(count);
+    check_idle();
+    return count;
+}
+
+void Chip8::attach(const Aot* code) {
+    aot = code;
+    memset(aot_unit, 0, sizeof(aot_unit));
+    aot_dead.clear();
+    if (aot == nullptr) {
+        return;
+    }
+
+    const Aot_Module* module = aot->module;
+    for (uint32_t u = 0; u < module->unit_count; u++) {
+        for (uint16_t addr = module->unit_start[u]; addr < module->unit_end[u]; addr++) {
+            aot_unit[addr & 0xFFF] = u + 1;
+        }
+    }
+    aot_dead.resize(module->unit_count);
+    check_aot();
+}
+
+void Chip8::check_aot() {
+    if (aot == nullptr) {
+        return;
+    }
+
+    // built for other quirks, none of it applies
+    const Aot_Module* module = aot->module;
+    bool same_platform = module->platform == uint32_t(platform);
+    for (uint32_t u = 0; u < module->unit_count; u++) {
+        uint16_t start = module->unit_start[u];
+        uint16_t size = module->unit_end[u] - start;
+        aot_dead[u] = !same_platform || memcmp(&s.memory[start], &module->image[start - 0x200], size) != 0;
+    }
+}
+
+int Chip8::run_aot() {
+    if (aot == nullptr) {
+        return run_cached();
+    }
+    if (s.pc >= 4096) {
+        tick(1);
+        return 1;
+    }
+    if (s.key_wait) {
+        return wait_key(ipf - s.frame_cycles);
+    }
+
+    Aot_Result result = Aot_Result();
+    int count = aot->module->run(&s, aot_dead.data(), ipf - s.frame_cycles, &result);
+    effects += result.effects;
+    idle_check |= result.loops;
+
+    if (count == 0) {
+        // not compiled, or compiled from bytes since overwritten
+        NoProfile none;
+        count = step_cached(none, ipf - s.frame_cycles);
+    }
+
+    tick(count);
+    check_idle();
+    return count;
+}
+
+int Chip8::run_threaded() {
+    switch (platform) {
+    case SUPER_CHIP: return run_threaded_as<SuperChip>();
+    case MODERN: return run_threaded_as<Modern>();
+    default: return run_threaded_as<Vip>();
+    }
+}
+
+template <class Q>
+int Chip8::run_threaded_as() {
+#if defined(__GNUC__)
+    if (s.pc >= 4096) {
+        tick(1);
+        return 1;
+    }
+    if (s.key_wait) {
+        return wait_key(ipf - s.frame_cycles);
+    }
+
+    // every handler ends by fetching and jumping straight to the next one
+    static void* const top[16] = {
+        &&op_0, &&op_1, &&op_2, &&op_3, &&op_4, &&op_5, &&op_6, &&op_7,
+        &&op_8, &&op_9, &&op_A, &&op_B, &&op_C, &&op_D, &&op_E, &&op_F
+    };
+    static void* const alu[16] = {
+        &&op_8XY0, &&op_8XY1, &&op_8XY2, &&op_8XY3, &&op_8XY4, &&op_8XY5, &&op_8XY6, &&op_8XY7,
+        &&op_other, &&op_other, &&op_other, &&op_other, &&op_other, &&op_other, &&op_8XYE, &&op_other
+    };
+
+    // timers and keys can't change before the frame ends
+    int budget = ipf - s.frame_cycles;
+    int count = 0;
+    uint16_t instr;
+
+#define X ((instr >> 8) & 0xF)
+#define Y ((instr >> 4) & 0xF)
+#define N (instr & 0xF)
+#define NN (instr & 0xFF)
+#define NNN (instr & 0xFFF)
+#define DISPATCH() \
+    do { \
+        if (++count >= budget || s.pc >= 4096) goto done; \
+        instr = s.memory[s.pc] << 8 | s.memory[(s.pc + 1) & 0xFFF]; \
+        s.pc += 2; \
+        goto *top[instr >> 12]; \
+    } while (0)
+
+    instr = s.memory[s.pc] << 8 | s.memory[(s.pc + 1) & 0xFFF];
+    s.pc += 2;
+    goto *top[instr >> 12];
+
+op_0:
+    if (instr == 0x00EE) {
+        ret0();
+        DISPATCH();
+    }
+    goto op_other;
+op_1:
+    jp1(NNN);
+    // leave at loop back-edges so idle detection sees them
+    if (idle_check) {
+        count++;
+        goto done;
+    }
+    DISPATCH();
+op_2: call2(NNN); DISPATCH();
+op_3: se3(X, NN); DISPATCH();
+op_4: sne4(X, NN); DISPATCH();
+op_5: goto op_other;
+op_6: ld6(X, NN); DISPATCH();
+op_7: add7(X, NN); DISPATCH();
+op_8: goto *alu[N];
+op_8XY0: ld8(X, Y); DISPATCH();
+op_8XY1: or8<Q>(X, Y); DISPATCH();
+op_8XY2: and8<Q>(X, Y); DISPATCH();
+op_8XY3: xor8<Q>(X, Y); DISPATCH();
+op_8XY4: add8(X, Y); DISPATCH();
+op_8XY5: sub8(X, Y); DISPATCH();
+op_8XY6: shr8<Q>(X, Y); DISPATCH();
+op_8XY7: subn8(X, Y); DISPATCH();
+op_8XYE: shl8<Q>(X, Y); DISPATCH();
+op_9: goto op_other;
+op_A: ldA(NNN); DISPATCH();
+op_B: jpB<Q>(NNN); DISPATCH();
+op_C: rndC(X, NN); DISPATCH();
+op_D: drwD<Q>(X, Y, N); DISPATCH();
+op_E: goto op_other;
+op_F:
+    switch (NN) {
+    case 0x1E: ldF_1E(X); DISPATCH();
+    case 0x29: ldF_29(X); DISPATCH();
+    case 0x33: ldF_33(X); DISPATCH();
+    case 0x55: ldF_55<Q>(X); DISPATCH();
+    case 0x65: ldF_65<Q>(X); DISPATCH();
+    }
+    goto op_other;
+
+    // everything rare goes through the switch
+op_other:
+    run_instr<Q>(instr);
+    if (idle_check) {
+        count++;
+        goto done;
+    }
+    DISPATCH();
+
+#undef X
+#undef Y
+#undef N
+#undef NN
+#undef NNN
+#undef DISPATCH
+
+done:
+    tick(count);
+    check_idle();
+    return count;
+#else
+    return run();
+#endif
+}
+
+void Chip8::tick(int count) {
+    s.cycles += count;
+    s.frame_cycles += count;
+
+    // FX18 ends the run, so it happened at the current cycle
+    if ((s.reg_s > 0) != beeping) {
+        beeping = !beeping;
+        host.beep(beeping, s.cycles);
+    }
+
+    while (s.frame_cycles >= uint32_t(ipf)) {
+        s.frame_cycles -= ipf;
+        if (s.reg_t > 0) {
+            s.reg_t--;
+        }
+        if (s.reg_s > 0) {
+            s.reg_s--;
+            if (s.reg_s == 0) {
+                beeping = false;
+                host.beep(false, s.cycles - s.frame_cycles);
             }
-            time = SDL_GetTicks64();
-            window.render();
+        }
+        s.frames++;
+        host.render(s.frame);
+        rows_dirty |= s.frame.dirty;
+        s.frame.dirty = 0;
+
+        if (cycle_horizon != 0 && s.frame_cycles < uint32_t(ipf)) {
+            check_cycle();
         }
     }
 }
 
+void Chip8::check_idle() {
+    if (!idle_check) {
+        return;
+    }
+    idle_check = false;
+
+    if (!idle_skip) {
+        return;
+    }
+
+    bool same = idle.pc == s.pc && idle.frames == s.frames && idle.effects == effects &&
+        idle.rng_state == s.rng_state && idle.reg_i == s.reg_i && idle.sp == s.sp &&
+        idle.reg_t == s.reg_t && idle.reg_s == s.reg_s && idle.key_wait == s.key_wait &&
+        memcmp(idle.reg_v, s.reg_v, sizeof(s.reg_v)) == 0 &&
+        memcmp(idle.key_held, s.key_held, sizeof(s.key_held)) == 0;
+
+    if (same) {
+        // skip every whole loop that fits before the frame boundary
+        uint64_t period = s.cycles - idle.cycles;
+        uint64_t left = ipf - s.frame_cycles;
+        uint64_t skip = left / period * period;
+        if (skip > 0) {
+            cycles_skipped += skip;
+            tick(skip);
+        }
+    }
+
+    idle.pc = s.pc;
+    idle.frames = s.frames;
+    idle.cycles = s.cycles;
+    idle.effects = effects;
+    idle.rng_state = s.rng_state;
+    idle.reg_i = s.reg_i;
+    idle.sp = s.sp;
+    idle.reg_t = s.reg_t;
+    idle.reg_s = s.reg_s;
+    idle.key_wait = s.key_wait;
+    memcpy(idle.reg_v, s.reg_v, sizeof(s.reg_v));
+    memcpy(idle.key_held, s.key_held, sizeof(s.key_held));
+}
+
+// one multiply and shift per 8 bytes: only has to spot repeats, a match is
+// confirmed by a full comparison anyway
+static uint64_t mix(uint64_t h, uint64_t word) {
+    h = (h ^ word) * 0x9E3779B97F4A7C15;
+    return h ^ (h >> 29);
+}
+
+static uint64_t mix_bytes(uint64_t h, const void* data, size_t size) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; i += 8) {
+        uint64_t word;
+        memcpy(&word, bytes + i, 8);
+        h = mix(h, word);
+    }
+    return h;
+}
+
+uint64_t Chip8::state_hash() {
+    // pieces are seeded with their index so equal contents in different
+    // places don't cancel out in the sums
+    for (int c = 0; chunks_dirty != 0; c++, chunks_dirty >>= 1) {
+        if (chunks_dirty & 1) {
+            uint64_t h = mix_bytes(c + 1, &s.memory[c * CYCLE_CHUNK], CYCLE_CHUNK);
+            memory_sum += h - chunk_hash[c];
+            chunk_hash[c] = h;
+        }
+    }
+    rows_dirty |= s.frame.dirty;
+    for (int y = 0; rows_dirty != 0; y++, rows_dirty >>= 1) {
+        if (rows_dirty & 1) {
+            uint64_t h = mix(y + 1, s.frame.rows[y]);
+            screen_sum += h - row_hash[y];
+            row_hash[y] = h;
+        }
+    }
+
+    // the registers are few enough to hash whole every time
+    uint64_t h = mix(memory_sum, screen_sum);
+    h = mix(h, uint64_t(s.pc) | uint64_t(s.sp) << 16 | uint64_t(s.reg_i) << 32 | uint64_t(s.reg_t) << 48 | uint64_t(s.reg_s) << 56);
+    h = mix(h, uint64_t(s.frame_cycles) | uint64_t(s.key_wait) << 32 | uint64_t(s.key_reg) << 40);
+    h = mix(h, s.rng_state);
+    h = mix_bytes(h, s.stack, sizeof(s.stack));
+    h = mix_bytes(h, s.reg_v, sizeof(s.reg_v));
+    return mix_bytes(h, s.key_held, sizeof(s.key_held));
+}
+
+bool Chip8::same_as(const State& saved) const {
+    return s.pc == saved.pc && s.sp == saved.sp && s.reg_i == saved.reg_i && s.reg_t == saved.reg_t && s.reg_s == saved.reg_s &&
+        s.frame_cycles == saved.frame_cycles && s.rng_state == saved.rng_state &&
+        s.key_wait == saved.key_wait && s.key_reg == saved.key_reg &&
+        memcmp(s.key_held, saved.key_held, sizeof(s.key_held)) == 0 &&
+        memcmp(s.reg_v, saved.reg_v, sizeof(s.reg_v)) == 0 &&
+        memcmp(s.stack, saved.stack, sizeof(s.stack)) == 0 &&
+        memcmp(s.memory, saved.memory, sizeof(s.memory)) == 0 &&
+        memcmp(s.frame.rows, saved.frame.rows, sizeof(s.frame.rows)) == 0;
+}
+
+void Chip8::check_cycle() {
+    // a cycle only repeats while nothing from outside changes
+    uint16_t keys = 0;
+    for (int k = 0; k < 16; k++) {
+        keys |= host.get_key_press(k) << k;
+    }
+    if (keys != cycle_keys) {
+        cycle_keys = keys;
+        keys_since = s.cycles;
+        candidate_period = 0;
+    }
+
+    uint64_t hash = state_hash();
+
+    if (candidate_period != 0 && s.cycles - candidate_cycles == candidate_period) {
+        if (same_as(*candidate)) {
+            // every period from here ends where it started, skip as many
+            // as fit before the horizon
+            uint64_t left = cycle_horizon > s.cycles ? cycle_horizon - s.cycles : 0;
+            uint64_t skip = left / candidate_period * candidate_period;
+            s.cycles += skip;
+            s.frames += skip / ipf;
+            cycles_skipped += skip;
+        }
+        candidate_period = 0;
+    } else if (candidate_period != 0 && s.cycles - candidate_cycles > candidate_period) {
+        candidate_period = 0;
+    }
+
+    Seen& slot = seen[hash & (CYCLE_SLOTS - 1)];
+    if (candidate_period == 0 && slot.hash == hash && slot.cycles >= keys_since && slot.cycles < s.cycles) {
+        // confirmed one period from now by a full comparison, a hash
+        // collision can't cause a skip
+        if (!candidate) {
+            candidate.reset(new State());
+        }
+        snapshot(*candidate);
+        candidate_cycles = s.cycles;
+        candidate_period = s.cycles - slot.cycles;
+    }
+    slot.hash = hash;
+    slot.cycles = s.cycles;
+}
+
+int Chip8::wait_key(int budget) {
+    for (uint8_t k = 0; k < 16; k++) {
+        bool down = host.get_key_press(k);
+
+        // only a fresh press completes the wait, taking the FX0A's slot
+        if (down && !s.key_held[k]) {
+            s.key_wait = false;
+            s.reg_v[s.key_reg] = k;
+            s.pc += 2;
+            tick(1);
+            return 1;
+        }
+        s.key_held[k] = down;
+    }
+
+    // keys only change between frames, nothing can happen before the end
+    // of this one
+    int count = std::max(1, std::min(budget, int(ipf - s.frame_cycles)));
+    tick(count);
+    return count;
+}
+
+template <class Q>
 void Chip8::run_instr(uint16_t instr) {
     switch (instr >> 12) {
     case 0x0:
@@ -99,23 +769,23 @@ void Chip8::run_instr(uint16_t instr) {
     case 0x8:
         switch (instr & 0xF) {
         case 0x0: return ld8((instr >> 8) & 0xF, (instr >> 4) & 0xF);
-        case 0x1: return or8((instr >> 8) & 0xF, (instr >> 4) & 0xF);
-        case 0x2: return and8((instr >> 8) & 0xF, (instr >> 4) & 0xF);
-        case 0x3: return xor8((instr >> 8) & 0xF, (instr >> 4) & 0xF);
+        case 0x1: return or8<Q>((instr >> 8) & 0xF, (instr >> 4) & 0xF);
+        case 0x2: return and8<Q>((instr >> 8) & 0xF, (instr >> 4) & 0xF);
+        case 0x3: return xor8<Q>((instr >> 8) & 0xF, (instr >> 4) & 0xF);
         case 0x4: return add8((instr >> 8) & 0xF, (instr >> 4) & 0xF);
         case 0x5: return sub8((instr >> 8) & 0xF, (instr >> 4) & 0xF);
-        case 0x6: return shr8((instr >> 8) & 0xF, (instr >> 4) & 0xF);
+        case 0x6: return shr8<Q>((instr >> 8) & 0xF, (instr >> 4) & 0xF);
         case 0x7: return subn8((instr >> 8) & 0xF, (instr >> 4) & 0xF);
-        case 0xE: return shl8((instr >> 8) & 0xF, (instr >> 4) & 0xF);
+        case 0xE: return shl8<Q>((instr >> 8) & 0xF, (instr >> 4) & 0xF);
         }
         break;
     case 0x9:
         if ((instr & 0xF) == 0) return sne9((instr >> 8) & 0xF, (instr >> 4) & 0xF);
         break;
     case 0xA: return ldA(instr & 0xFFF);
-    case 0xB: return jpB(instr & 0xFFF);
+    case 0xB: return jpB<Q>(instr & 0xFFF);
     case 0xC: return rndC((instr >> 8) & 0xF, instr & 0xFF);
-    case 0xD: return drwD((instr >> 8) & 0xF, (instr >> 4) & 0xF, instr & 0xF);
+    case 0xD: return drwD<Q>((instr >> 8) & 0xF, (instr >> 4) & 0xF, instr & 0xF);
     case 0xE:
         switch (instr & 0xFF) {
         case 0x9E: return skpE((instr >> 8) & 0xF);
@@ -131,29 +801,317 @@ void Chip8::run_instr(uint16_t instr) {
         case 0x1E: return ldF_1E((instr >> 8) & 0xF);
         case 0x29: return ldF_29((instr >> 8) & 0xF);
         case 0x33: return ldF_33((instr >> 8) & 0xF);
-        case 0x55: return ldF_55((instr >> 8) & 0xF);
-        case 0x65: return ldF_65((instr >> 8) & 0xF);
+        case 0x55: return ldF_55<Q>((instr >> 8) & 0xF);
+        case 0x65: return ldF_65<Q>((instr >> 8) & 0xF);
         }
         break;
     }
 
-    std::cerr << "Unknown instruction: 0x" << std::hex << instr << "\n";
+    host.fault({ Fault::UNKNOWN_INSTRUCTION, uint16_t(s.pc - 2), instr });
+}
+
+// -- Predecode cache
+
+template <class Q>
+Chip8::Op Chip8::decode(uint16_t instr) {
+    Op op;
+    op.fn = exec_unknown;
+    op.instr = instr;
+    op.nnn = instr & 0xFFF;
+    op.x = (instr >> 8) & 0xF;
+    op.y = (instr >> 4) & 0xF;
+    op.n = instr & 0xF;
+    op.nn = instr & 0xFF;
+
+    // same layout as run_instr
+    switch (instr >> 12) {
+    case 0x0:
+        switch (instr) {
+        case 0x00E0: op.fn = exec<&Chip8::cls0>; break;
+        case 0x00EE: op.fn = exec<&Chip8::ret0>; break;
+        default: op.fn = exec_nnn<&Chip8::sys0>; break;
+        }
+        break;
+    case 0x1: op.fn = exec_nnn<&Chip8::jp1>; break;
+    case 0x2: op.fn = exec_nnn<&Chip8::call2>; break;
+    case 0x3: op.fn = exec_xnn<&Chip8::se3>; break;
+    case 0x4: op.fn = exec_xnn<&Chip8::sne4>; break;
+    case 0x5:
+        if (op.n == 0) op.fn = exec_xy<&Chip8::se5>;
+        break;
+    case 0x6: op.fn = exec_xnn<&Chip8::ld6>; break;
+    case 0x7: op.fn = exec_xnn<&Chip8::add7>; break;
+    case 0x8:
+        switch (op.n) {
+        case 0x0: op.fn = exec_xy<&Chip8::ld8>; break;
+        case 0x1: op.fn = exec_xy<&Chip8::or8<Q>>; break;
+        case 0x2: op.fn = exec_xy<&Chip8::and8<Q>>; break;
+        case 0x3: op.fn = exec_xy<&Chip8::xor8<Q>>; break;
+        case 0x4: op.fn = exec_xy<&Chip8::add8>; break;
+        case 0x5: op.fn = exec_xy<&Chip8::sub8>; break;
+        case 0x6: op.fn = exec_xy<&Chip8::shr8<Q>>; break;
+        case 0x7: op.fn = exec_xy<&Chip8::subn8>; break;
+        case 0xE: op.fn = exec_xy<&Chip8::shl8<Q>>; break;
+        }
+        break;
+    case 0x9:
+        if (op.n == 0) op.fn = exec_xy<&Chip8::sne9>;
+        break;
+    case 0xA: op.fn = exec_nnn<&Chip8::ldA>; break;
+    case 0xB: op.fn = exec_nnn<&Chip8::jpB<Q>>; break;
+    case 0xC: op.fn = exec_xnn<&Chip8::rndC>; break;
+    case 0xD: op.fn = exec_xyn<&Chip8::drwD<Q>>; break;
+    case 0xE:
+        switch (op.nn) {
+        case 0x9E: op.fn = exec_x<&Chip8::skpE>; break;
+        case 0xA1: op.fn = exec_x<&Chip8::sknpE>; break;
+        }
+        break;
+    case 0xF:
+        switch (op.nn) {
+        case 0x7: op.fn = exec_x<&Chip8::ldF_7>; break;
+        case 0xA: op.fn = exec_x<&Chip8::ldF_A>; break;
+        case 0x15: op.fn = exec_x<&Chip8::ldF_15>; break;
+        case 0x18: op.fn = exec_x<&Chip8::ldF_18>; break;
+        case 0x1E: op.fn = exec_x<&Chip8::ldF_1E>; break;
+        case 0x29: op.fn = exec_x<&Chip8::ldF_29>; break;
+        case 0x33: op.fn = exec_x<&Chip8::ldF_33>; break;
+        case 0x55: op.fn = exec_x<&Chip8::ldF_55<Q>>; break;
+        case 0x65: op.fn = exec_x<&Chip8::ldF_65<Q>>; break;
+        }
+        break;
+    }
+    return op;
+}
+
+// a write to addr changes the instructions starting at addr - 1 and addr
+void Chip8::invalidate(uint16_t addr) {
+    cache[addr & 0xFFF].fn = decoder;
+    cache[(addr - 1) & 0xFFF].fn = decoder;
+
+    // and any superinstruction reaching over it
+    if (in_fused[addr & 0xFFF]) {
+        for (int i = 2; i < 6; i++) {
+            cache[(addr - i) & 0xFFF].fn = decoder;
+        }
+    }
+
+    if (jit) {
+        jit->invalidate(addr);
+    }
+
+    chunks_dirty |= 1ull << ((addr & 0xFFF) / CYCLE_CHUNK);
+
+    if (aot_unit[addr & 0xFFF] != 0) {
+        aot_dead[aot_unit[addr & 0xFFF] - 1] = true;
+    }
+}
+
+void Chip8::invalidate_all() {
+    for (int i = 0; i < 4096; i++) {
+        cache[i].fn = decoder;
+        in_fused[i] = false;
+    }
+
+    if (jit) {
+        jit->flush();
+    }
+
+    chunks_dirty = ~0ull;
+    check_aot();
+}
+
+// the same as exec_decode, ahead of time
+template <class Q>
+void Chip8::prepare_cache(const Analysis& analysis) {
+    for (const Analysis::Block& block : analysis.blocks) {
+        for (uint16_t addr = block.start; addr < block.end; addr += 2) {
+            Op& op = cache[addr & 0xFFF];
+            op = decode<Q>(s.memory[addr & 0xFFF] << 8 | s.memory[(addr + 1) & 0xFFF]);
+            fuse<Q>(*this, addr & 0xFFF, op);
+        }
+    }
+}
+
+void Chip8::prepare(const Analysis& analysis, Engine engine) {
+    // the AOT engine runs whatever wasn't compiled through the cache
+    if (engine == CACHED || engine == AOT) {
+        switch (platform) {
+        case VIP: return prepare_cache<Vip>(analysis);
+        case SUPER_CHIP: return prepare_cache<SuperChip>(analysis);
+        case MODERN: return prepare_cache<Modern>(analysis);
+        }
+    } else if (engine == JIT) {
+        if (!jit) {
+            start_jit();
+        }
+        for (const Analysis::Block& block : analysis.blocks) {
+            jit->lookup(block.start, s.memory);
+        }
+    }
+}
+
+// first execution at an address: decode, remember and run it
+template <class Q>
+void Chip8::exec_decode(Chip8& c, const Op&) {
+    uint16_t addr = c.s.pc - 2;
+    Op& op = c.cache[addr];
+    op = decode<Q>(c.s.memory[addr] << 8 | c.s.memory[(addr + 1) & 0xFFF]);
+    fuse<Q>(c, addr, op);
+    op.fn(c, op);
+}
+
+// -- Superinstructions
+
+template <class Q>
+void Chip8::fuse(Chip8& c, uint16_t addr, Op& op) {
+    if (addr + 6 > 4096) {
+        return;
+    }
+    uint16_t next = c.s.memory[addr + 2] << 8 | c.s.memory[addr + 3];
+    uint16_t third = c.s.memory[addr + 4] << 8 | c.s.memory[addr + 5];
+
+    // any of these bytes may end up in the entry, writes to them have to
+    // drop it
+    for (int i = 2; i < 6; i++) {
+        c.in_fused[addr + i] = true;
+    }
+
+    switch (op.instr >> 12) {
+    case 0x6:
+        if ((next >> 12) != 0x6) {
+            return;
+        }
+        op.x2 = (next >> 8) & 0xF;
+        op.nn2 = next & 0xFF;
+        op.fn = fuse_ld_ld;
+
+        // DXYN drawing at the two registers just loaded
+        if ((third & 0xFF00) == (0xD000 | op.x << 8) && ((third >> 4) & 0xF) == op.x2) {
+            op.n3 = third & 0xF;
+            op.fn = fuse_ld_ld_drw<Q>;
+        }
+        return;
+    case 0xA:
+        if ((next & 0xF0FF) != 0xF01E) {
+            return;
+        }
+        op.x2 = (next >> 8) & 0xF;
+        op.fn = fuse_ldi_addi;
+        return;
+    }
+
+    // a skip over a jump
+    if ((next >> 12) != 0x1) {
+        return;
+    }
+    op.nnn2 = next & 0xFFF;
+    if (op.fn == exec_xnn<&Chip8::se3>) {
+        op.fn = fuse_skip_jp<exec_xnn<&Chip8::se3>>;
+    } else if (op.fn == exec_xnn<&Chip8::sne4>) {
+        op.fn = fuse_skip_jp<exec_xnn<&Chip8::sne4>>;
+    } else if (op.fn == exec_x<&Chip8::skpE>) {
+        op.fn = fuse_skip_jp<exec_x<&Chip8::skpE>>;
+    } else if (op.fn == exec_x<&Chip8::sknpE>) {
+        op.fn = fuse_skip_jp<exec_x<&Chip8::sknpE>>;
+    }
+}
+
+void Chip8::fuse_ld_ld(Chip8& c, const Op& op) {
+    c.ld6(op.x, op.nn);
+    if (c.step_budget < 2) {
+        return;
+    }
+    c.s.pc += 2;
+    c.ld6(op.x2, op.nn2);
+    c.step_fused = 1;
+}
+
+template <class Q>
+void Chip8::fuse_ld_ld_drw(Chip8& c, const Op& op) {
+    fuse_ld_ld(c, op);
+    if (c.step_budget < 3) {
+        return;
+    }
+    c.s.pc += 2;
+    c.drwD<Q>(op.x, op.x2, op.n3);
+    c.step_fused = 2;
+}
+
+void Chip8::fuse_ldi_addi(Chip8& c, const Op& op) {
+    c.ldA(op.nnn);
+    if (c.step_budget < 2) {
+        return;
+    }
+    c.s.pc += 2;
+    c.ldF_1E(op.x2);
+    c.step_fused = 1;
+}
+
+template <Chip8::Handler SKIP>
+void Chip8::fuse_skip_jp(Chip8& c, const Op& op) {
+    uint16_t next = c.s.pc;
+    SKIP(c, op);
+
+    // skipped: the jump never executes
+    if (c.s.pc != next || c.step_budget < 2) {
+        return;
+    }
+    c.s.pc += 2;
+    c.jp1(op.nnn2);
+    c.step_fused = 1;
+}
+
+void Chip8::exec_unknown(Chip8& c, const Op& op) {
+    c.host.fault({ Fault::UNKNOWN_INSTRUCTION, uint16_t(c.s.pc - 2), op.instr });
+}
+
+template <void (Chip8::*F)()>
+void Chip8::exec(Chip8& c, const Op&) {
+    (c.*F)();
+}
+
+template <void (Chip8::*F)(uint16_t)>
+void Chip8::exec_nnn(Chip8& c, const Op& op) {
+    (c.*F)(op.nnn);
+}
+
+template <void (Chip8::*F)(uint8_t)>
+void Chip8::exec_x(Chip8& c, const Op& op) {
+    (c.*F)(op.x);
+}
+
+template <void (Chip8::*F)(uint8_t, uint8_t)>
+void Chip8::exec_xnn(Chip8& c, const Op& op) {
+    (c.*F)(op.x, op.nn);
+}
+
+template <void (Chip8::*F)(uint8_t, uint8_t)>
+void Chip8::exec_xy(Chip8& c, const Op& op) {
+    (c.*F)(op.x, op.y);
+}
+
+template <void (Chip8::*F)(uint8_t, uint8_t, uint8_t)>
+void Chip8::exec_xyn(Chip8& c, const Op& op) {
+    (c.*F)(op.x, op.y, op.n);
 }
 
 // -- Instructions
 
 // 0x0
 void Chip8::cls0() {
-    window.clear_pixels();
+    s.frame.clear();
+    effects++;
 }
 
 void Chip8::ret0() {
-    if (sp == 0) {
-        std::cerr << "Stack Underflow Error in ret0()" << std::endl;
+    if (s.sp == 0) {
+        host.fault({ Fault::STACK_UNDERFLOW, uint16_t(s.pc - 2), 0x00EE });
         return;
     }
-    sp--;
-    pc = stack[sp];
+    s.sp--;
+    s.pc = s.stack[s.sp];
+    effects++;
 }
 
 void Chip8::sys0(uint16_t addr) {
@@ -162,285 +1120,311 @@ void Chip8::sys0(uint16_t addr) {
 
 // 0x1
 void Chip8::jp1(uint16_t addr) {
-    pc = addr;
+    // jumping back is how every busy-wait loop closes
+    idle_check |= addr < s.pc;
+    s.pc = addr;
 }
 
 // 0x2
 void Chip8::call2(uint16_t addr) {
-    if (sp >= 16) {
-        std::cerr << "Stack Overflow in call2()\n";
+    if (s.sp >= 16) {
+        host.fault({ Fault::STACK_OVERFLOW, uint16_t(s.pc - 2), uint16_t(0x2000 | addr) });
         return;
     }
-    stack[sp] = pc;
-    sp++;
-    pc = addr;
+    s.stack[s.sp] = s.pc;
+    s.sp++;
+    s.pc = addr;
+    effects++;
 }
 
 // 0x3
 void Chip8::se3(uint8_t vx, uint8_t byte) {
-    if (reg_v[vx] == byte) {
-        pc += 2;
+    if (s.reg_v[vx] == byte) {
+        s.pc += 2;
     }
 }
 
 // 0x4
 void Chip8::sne4(uint8_t vx, uint8_t byte) {
-    if (reg_v[vx] != byte) {
-        pc += 2;
+    if (s.reg_v[vx] != byte) {
+        s.pc += 2;
     }
 }
 
 // 0x5
 void Chip8::se5(uint8_t vx, uint8_t vy) {
-    if (reg_v[vx] == reg_v[vy]) {
-        pc += 2;
+    if (s.reg_v[vx] == s.reg_v[vy]) {
+        s.pc += 2;
     }
 }
 
 // 0x6
 void Chip8::ld6(uint8_t vx, uint8_t byte) {
-    reg_v[vx] = byte;
+    s.reg_v[vx] = byte;
 }
 
 // 0x7
 void Chip8::add7(uint8_t vx, uint8_t byte) {
-    reg_v[vx] += byte;
+    s.reg_v[vx] += byte;
 }
 
 // 0x8
 void Chip8::ld8(uint8_t vx, uint8_t vy) {
-    reg_v[vx] = reg_v[vy];
+    s.reg_v[vx] = s.reg_v[vy];
 }
 
+template <class Q>
 void Chip8::or8(uint8_t vx, uint8_t vy) {
-    reg_v[vx] |= reg_v[vy];
-    reg_v[0xF] = 0;
+    s.reg_v[vx] |= s.reg_v[vy];
+    if (Q::vf_reset)
+        s.reg_v[0xF] = 0;
 }
 
+template <class Q>
 void Chip8::and8(uint8_t vx, uint8_t vy) {
-    reg_v[vx] &= reg_v[vy];
-    reg_v[0xF] = 0;
+    s.reg_v[vx] &= s.reg_v[vy];
+    if (Q::vf_reset)
+        s.reg_v[0xF] = 0;
 
 }
 
+template <class Q>
 void Chip8::xor8(uint8_t vx, uint8_t vy) {
-    reg_v[vx] ^= reg_v[vy];
-    reg_v[0xF] = 0;
+    s.reg_v[vx] ^= s.reg_v[vy];
+    if (Q::vf_reset)
+        s.reg_v[0xF] = 0;
 }
 
 void Chip8::add8(uint8_t vx, uint8_t vy) {
     // compute sum in 16-bit
-    uint16_t sum = reg_v[vx] + reg_v[vy];
+    uint16_t sum = s.reg_v[vx] + s.reg_v[vy];
 
     // flag overflow
     if (sum > 0xFF)
-        reg_v[0xF] = 1;
+        s.reg_v[0xF] = 1;
     else
-        reg_v[0xF] = 0;
+        s.reg_v[0xF] = 0;
 
     // do not update Vf
     if (vx != 0xF)
         // only keep 8-lower bits
-        reg_v[vx] = (sum & 0xFF);
+        s.reg_v[vx] = (sum & 0xFF);
 
 }
 
 void Chip8::sub8(uint8_t vx, uint8_t vy) {
-    uint8_t diff = reg_v[vx] - reg_v[vy];
+    uint8_t diff = s.reg_v[vx] - s.reg_v[vy];
 
     // flag underflow
-    if (reg_v[vx] >= reg_v[vy])
-        reg_v[0xF] = 1;
+    if (s.reg_v[vx] >= s.reg_v[vy])
+        s.reg_v[0xF] = 1;
     else
-        reg_v[0xF] = 0;
+        s.reg_v[0xF] = 0;
 
     // do not update Vf
     if (vx != 0xF)
-        reg_v[vx] = diff;
+        s.reg_v[vx] = diff;
 }
 
 // shift right
+template <class Q>
 void Chip8::shr8(uint8_t vx, uint8_t vy) {
+    // SUPER-CHIP shifts vx in place
+    if (Q::shift_vx)
+        vy = vx;
+
     // set Vf to the least significant bit
-    reg_v[0xF] = reg_v[vy] & 0b1;
+    s.reg_v[0xF] = s.reg_v[vy] & 0b1;
 
     // update if not Vf
     if (vx != 0xF)
-        reg_v[vx] = reg_v[vy] >> 1;
+        s.reg_v[vx] = s.reg_v[vy] >> 1;
 }
 
 // note: similar so sub8 however vy and vx order is swapped
 void Chip8::subn8(uint8_t vx, uint8_t vy) {
-    uint8_t diff = reg_v[vy] - reg_v[vx];
+    uint8_t diff = s.reg_v[vy] - s.reg_v[vx];
 
     // flag underflow
-    if (reg_v[vx] <= reg_v[vy])
-        reg_v[0xF] = 1;
+    if (s.reg_v[vx] <= s.reg_v[vy])
+        s.reg_v[0xF] = 1;
     else
-        reg_v[0xF] = 0;
+        s.reg_v[0xF] = 0;
 
     // set if not Vf
     if (vx != 0xF)
-        reg_v[vx] = diff;
+        s.reg_v[vx] = diff;
 }
 
 // shift left
+template <class Q>
 void Chip8::shl8(uint8_t vx, uint8_t vy) {
+    if (Q::shift_vx)
+        vy = vx;
+
     // store most significant bit in Vf
-    reg_v[0xF] = (reg_v[vy] >> 7) & 0b1;
+    s.reg_v[0xF] = (s.reg_v[vy] >> 7) & 0b1;
 
     // update if not Vf
     if (vx != 0xF)
-        reg_v[vx] = reg_v[vy] << 1;
+        s.reg_v[vx] = s.reg_v[vy] << 1;
 }
 
 // 0x9
 void Chip8::sne9(uint8_t vx, uint8_t vy) {
-    if (reg_v[vx] != reg_v[vy]) {
-        pc += 2;
+    if (s.reg_v[vx] != s.reg_v[vy]) {
+        s.pc += 2;
     }
 }
 
 // 0xA
 void Chip8::ldA(uint16_t addr) {
-    reg_i = addr;
+    s.reg_i = addr;
 }
 
 // 0xB
+template <class Q>
 void Chip8::jpB(uint16_t addr) {
-    pc = addr + reg_v[0];
+    // SUPER-CHIP reads the high nibble of the address as a register: BXNN
+    s.pc = addr + s.reg_v[Q::jump_vx ? (addr >> 8) & 0xF : 0];
 }
 
 // 0xC
 void Chip8::rndC(uint8_t vx, uint8_t byte) {
-    reg_v[vx] = (rand() % 256) & byte;
+    s.reg_v[vx] = random_byte(s.rng_state) & byte;
 }
 
 // 0xD
+template <class Q>
 void Chip8::drwD(uint8_t vx, uint8_t vy, uint8_t nibble) {
+    effects++;
+
     // Clear collision flag.
-    reg_v[0xF] = 0;
+    s.reg_v[0xF] = 0;
 
     // Calculate starting coordinates (wrap around)
-    uint8_t x0 = reg_v[vx] % 64;
-    uint8_t y0 = reg_v[vy] % 32;
+    uint8_t x0 = s.reg_v[vx] % 64;
+    uint8_t y0 = s.reg_v[vy] % 32;
 
-    // Loop over each row of the sprite
+    // One shift and XOR per row of the sprite
+    bool collision = false;
     for (int i = 0; i < nibble; i++) {
-        uint8_t byte = memory[reg_i + i];
         uint8_t y = (y0 + i);
 
+        if (!Q::clip) {
+            collision |= s.frame.draw_row_wrapped(x0, y % 32, s.memory[(s.reg_i + i) & 0xFFF]);
+            continue;
+        }
+
         // dont render if the sprite is clipping
         if (y > 31) {
             break;
         }
 
-        // Loop over each bit in the byte.
-        for (int j = 7; j >= 0; j--) {
-            // Compute the pixel's x and y positions.
-            uint8_t x = (x0 + (7 - j));
-
-            // don't render if the sprite is clipping
-            if (x > 63) {
-                break;
-            }
-
-            // get the new and old bit and check the results
-            bool bit = (byte >> j) & 0x1;
-            bool old_bit = window.get_pixel(x, y);
-            bool result = bit ^ old_bit;
-
-            // If the pixel was turned off by the XOR, set the collision flag.
-            if (!result && old_bit) {
-                reg_v[0xF] = 1;
-            }
+        collision |= s.frame.draw_row(x0, y, s.memory[(s.reg_i + i) & 0xFFF]);
+    }
 
-            // update pixel
-            window.set_pixel(x, y, result);
-        }
+    // If any pixel was turned off by the XOR, set the collision flag.
+    if (collision) {
+        s.reg_v[0xF] = 1;
     }
 }
 
 // 0xE
+// VX can hold any byte but only keys 0-F exist; the others are never
+// pressed, as in Lockstep, and hosts only ever see a valid key
 void Chip8::skpE(uint8_t vx) {
-    if (window.get_key_press(reg_v[vx])) {
-        pc += 2;
+    if (s.reg_v[vx] < 16 && host.get_key_press(s.reg_v[vx])) {
+        s.pc += 2;
     }
 }
 
 void Chip8::sknpE(uint8_t vx) {
-    if (!window.get_key_press(reg_v[vx])) {
-        pc += 2;
+    if (!(s.reg_v[vx] < 16 && host.get_key_press(s.reg_v[vx]))) {
+        s.pc += 2;
     }
 }
 
 // 0xF
 void Chip8::ldF_7(uint8_t vx) {
-    reg_v[vx] = reg_t;
+    s.reg_v[vx] = s.reg_t;
 }
 
+// FX0A halts the cpu, see wait_key
 void Chip8::ldF_A(uint8_t vx) {
-    uint8_t key = 0xFE;
-    while (key > 0xF) {
-        // continue updating
-        if (SDL_GetTicks64() - time >= 16) {
-            if (reg_t > 0) {
-                reg_t--;
-            }
-            if (reg_s > 0) {
-                reg_s--;
-            }
-            time = SDL_GetTicks64();
-            window.render();
-        }
-
-        // wait to get a key press
-        key = window.await_keypress();
-
-        // exit has been called
-        if (key == 0xFF) {
-            return;
-        }
+    // keys already held when the wait starts don't count
+    for (int k = 0; k < 16; k++) {
+        s.key_held[k] = host.get_key_press(k);
     }
-    reg_v[vx] = key;
+    s.key_wait = true;
+    s.key_reg = vx;
+
+    // pc stays on the FX0A while halted
+    s.pc -= 2;
+    idle_check = true;
 }
 
 void Chip8::ldF_15(uint8_t vx) {
-    reg_t = reg_v[vx];
+    s.reg_t = s.reg_v[vx];
 }
 
 void Chip8::ldF_18(uint8_t vx) {
-    reg_s = reg_v[vx];
+    s.reg_s = s.reg_v[vx];
+
+    // end the run so tick() stamps the beeper edge with this cycle
+    idle_check = true;
 }
 
 void Chip8::ldF_1E(uint8_t vx) {
-    reg_i += reg_v[vx];
+    s.reg_i += s.reg_v[vx];
 }
 
 void Chip8::ldF_29(uint8_t vx) {
-    reg_i = 5 * reg_v[vx];
+    s.reg_i = 5 * s.reg_v[vx];
 }
 
 void Chip8::ldF_33(uint8_t vx) {
-    uint8_t value = reg_v[vx];
-    memory[reg_i] = value / 100;
-    memory[reg_i + 1] = (value / 10) % 10;
-    memory[reg_i + 2] = value % 10;
+    // I can point anywhere in 16 bits, memory wraps at 4K
+    uint8_t value = s.reg_v[vx];
+    s.memory[s.reg_i & 0xFFF] = value / 100;
+    s.memory[(s.reg_i + 1) & 0xFFF] = (value / 10) % 10;
+    s.memory[(s.reg_i + 2) & 0xFFF] = value % 10;
+
+    effects++;
+
+    // keep self-modifying code correct
+    for (int i = 0; i < 3; i++) {
+        invalidate((s.reg_i + i) & 0xFFF);
+    }
 }
 
 // load register to memory
+template <class Q>
 void Chip8::ldF_55(uint8_t vx) {
+    effects++;
+    uint16_t start = s.reg_i;
+
     // load Vx into memory
     for (int i = 0; i <= vx; i++) {
-        memory[reg_i] = reg_v[i];
-        reg_i++;
+        s.memory[s.reg_i & 0xFFF] = s.reg_v[i];
+        invalidate(s.reg_i & 0xFFF);
+        s.reg_i++;
     }
+
+    if (!Q::memory_increment)
+        s.reg_i = start;
 }
 
 // load register from memory
+template <class Q>
 void Chip8::ldF_65(uint8_t vx) {
+    uint16_t start = s.reg_i;
+
     for (int i = 0; i <= vx; i++) {
-        reg_v[i] = memory[reg_i];
-        reg_i++;
+        s.reg_v[i] = s.memory[s.reg_i & 0xFFF];
+        s.reg_i++;
     }
+
+    if (!Q::memory_increment)
+        s.reg_i = start;
 }
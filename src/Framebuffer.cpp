@@ -0,0 +1,16 @@
+#include "Framebuffer.h"
+
+bool Framebuffer::get_pixel(int x, int y) const {
+    return (rows[y] >> (63 - x)) & 0x1;
+}
+
+uint64_t Framebuffer::hash() const {
+    uint64_t h = 0xcbf29ce484222325;
+    for (int y = 0; y < BUF_HEIGHT; y++) {
+        for (int i = 0; i < 8; i++) {
+            h ^= (rows[y] >> (8 * i)) & 0xFF;
+            h *= 0x100000001b3;
+        }
+    }
+    return h;
+}
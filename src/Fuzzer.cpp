@@ -0,0 +1,281 @@
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include "Fuzzer.h"
+
+// longest key timeline a mutation may grow
+#define FUZZ_MAX_KEYS 256
+
+// splitmix64 at full width, one stream per worker
+static uint64_t next_random(uint64_t& state) {
+    uint64_t z = (state += 0x9E3779B97F4A7C15);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+    return z ^ (z >> 31);
+}
+
+// keys held during a frame
+static uint16_t mask_at(const std::vector<InputLog::Keys>& keys, uint64_t frame) {
+    uint16_t mask = 0;
+    for (const InputLog::Keys& k : keys) {
+        if (k.frame > frame) {
+            break;
+        }
+        mask = k.mask;
+    }
+    return mask;
+}
+
+// -- Target
+
+void Fuzzer::Target::start(const InputLog& input) {
+    log = &input;
+    next_keys = 0;
+    keys = 0;
+    frames = 0;
+    faults.clear();
+}
+
+void Fuzzer::Target::render(const Framebuffer&) {
+    frames++;
+    while (next_keys < log->keys.size() && log->keys[next_keys].frame <= frames) {
+        keys = log->keys[next_keys++].mask;
+    }
+}
+
+void Fuzzer::Target::poll() {}
+
+bool Fuzzer::Target::get_key_press(int idx) {
+    return idx < 16 && ((keys >> idx) & 0x1);
+}
+
+void Fuzzer::Target::fault(const Fault& f) {
+    // a rom stuck faulting every frame only needs reporting once
+    if (faults.size() < 16) {
+        faults.push_back({ f, frames, 0, InputLog() });
+    }
+}
+
+// -- Fuzzer
+
+Fuzzer::Fuzzer(const std::vector<uint8_t>& rom, uint64_t rom_hash, int ipf, Platform platform, uint64_t frames) :
+    frames(std::max<uint64_t>(frames, 2)) {
+    settings.ipf = ipf;
+    settings.platform = platform;
+    settings.rom_hash = rom_hash;
+
+    // start from no keys at all
+    corpus.push_back(settings);
+
+    // every trial starts from here
+    Target target;
+    Chip8 chip(target, rom.data(), rom.size());
+    chip.snapshot(power_on);
+}
+
+Fuzzer::~Fuzzer() {}
+
+void Fuzzer::run(uint64_t trials, unsigned threads) {
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    std::vector<std::thread> workers;
+    uint64_t end = next_trial + trials;
+    for (unsigned id = 0; id < threads; id++) {
+        workers.emplace_back(&Fuzzer::worker, this, id, end);
+    }
+    for (std::thread& t : workers) {
+        t.join();
+    }
+}
+
+uint64_t Fuzzer::edge_count() const {
+    return edges;
+}
+
+size_t Fuzzer::corpus_size() const {
+    return corpus.size();
+}
+
+const std::vector<Fuzzer::Event>& Fuzzer::events() const {
+    return found;
+}
+
+void Fuzzer::worker(unsigned id, uint64_t end) {
+    Target target;
+    State state = power_on;
+    Chip8 chip(target, state);
+    chip.set_ipf(settings.ipf);
+    chip.set_platform(settings.platform);
+
+    std::unique_ptr<Coverage> trial(new Coverage());
+    std::vector<uint8_t> known(Coverage::EDGES / 8);
+    uint64_t rng = 0x2545F4914F6CDD1D * (id + 1);
+
+    while (true) {
+        InputLog input;
+        InputLog other;
+        uint64_t trial_id;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (next_trial >= end) {
+                return;
+            }
+            trial_id = next_trial++;
+            input = corpus[next_random(rng) % corpus.size()];
+            other = corpus[next_random(rng) % corpus.size()];
+        }
+        mutate(input, other, rng);
+
+        memset(trial->bits, 0, sizeof(trial->bits));
+        trial->prev = 0;
+        play(chip, target, power_on, input, frames, *trial);
+        merge(*trial, known.data(), target, input, trial_id);
+    }
+}
+
+template <class P>
+void Fuzzer::play(Chip8& chip, Target& target, const State& start, const InputLog& input, uint64_t stop, P& profile) {
+    chip.restore(start);
+    chip.seed(input.seed);
+    target.start(input);
+    while (target.frames < stop) {
+        chip.run_cached(0, profile);
+    }
+}
+
+void Fuzzer::mutate(InputLog& input, const InputLog& other, uint64_t& rng) const {
+    std::vector<InputLog::Keys>& keys = input.keys;
+    int count = 1 + next_random(rng) % 4;
+
+    for (int i = 0; i < count; i++) {
+        // frame 0 stays empty: a recorder only latches keys from frame 1 on,
+        // so a reproduced log couldn't hold any earlier
+        uint64_t frame = 1 + next_random(rng) % (frames - 1);
+        uint16_t key = 1 << (next_random(rng) % 16);
+        uint16_t held = mask_at(keys, frame);
+
+        switch (next_random(rng) % 6) {
+        case 0:
+            input.seed = next_random(rng);
+            break;
+        case 1:
+            // press or release one key from here on
+            keys.push_back({ frame, uint16_t(held ^ key) });
+            break;
+        case 2:
+            // tap a key for a few frames
+            keys.push_back({ frame, uint16_t(held | key) });
+            keys.push_back({ frame + 1 + next_random(rng) % 8, held });
+            break;
+        case 3:
+            if (!keys.empty()) {
+                keys.erase(keys.begin() + next_random(rng) % keys.size());
+            }
+            break;
+        case 4:
+            // move a change a few frames either way
+            if (!keys.empty()) {
+                InputLog::Keys& k = keys[next_random(rng) % keys.size()];
+                uint64_t shift = 1 + next_random(rng) % 8;
+                k.frame = next_random(rng) % 2 == 0 ? k.frame + shift : std::max<uint64_t>(k.frame, shift + 1) - shift;
+            }
+            break;
+        case 5:
+            // our timeline up to frame, the other one's after it
+            keys.erase(std::remove_if(keys.begin(), keys.end(),
+                [frame](const InputLog::Keys& k) { return k.frame >= frame; }), keys.end());
+            for (const InputLog::Keys& k : other.keys) {
+                if (k.frame >= frame) {
+                    keys.push_back(k);
+                }
+            }
+            break;
+        }
+
+        // back into frame order, the latest edit winning within a frame;
+        // changes past the trial and changes to the same mask go
+        std::stable_sort(keys.begin(), keys.end(),
+            [](const InputLog::Keys& a, const InputLog::Keys& b) { return a.frame < b.frame; });
+        std::vector<InputLog::Keys> tidy;
+        for (const InputLog::Keys& k : keys) {
+            if (k.frame >= frames) {
+                break;
+            }
+            if (!tidy.empty() && tidy.back().frame == k.frame) {
+                tidy.pop_back();
+            }
+            uint16_t before = tidy.empty() ? 0 : tidy.back().mask;
+            if (k.mask != before && tidy.size() < FUZZ_MAX_KEYS) {
+                tidy.push_back(k);
+            }
+        }
+        keys.swap(tidy);
+    }
+}
+
+void Fuzzer::merge(const Coverage& trial, uint8_t* known, Target& target, const InputLog& input, uint64_t id) {
+    bool fresh = !target.faults.empty();
+    for (int i = 0; i < Coverage::EDGES / 8 && !fresh; i++) {
+        fresh = (trial.bits[i] & ~known[i]) != 0;
+    }
+    if (!fresh) {
+        return;
+    }
+
+    std::vector<Event> events;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        bool added = false;
+        for (int i = 0; i < Coverage::EDGES / 8; i++) {
+            for (uint8_t bits = trial.bits[i] & ~coverage[i]; bits != 0; bits &= bits - 1) {
+                edges++;
+                added = true;
+            }
+            coverage[i] |= trial.bits[i];
+        }
+        memcpy(known, coverage, sizeof(coverage));
+
+        // one event per kind of fault per address
+        for (Event& e : target.faults) {
+            if (seen.insert(uint32_t(e.fault.kind) << 16 | e.fault.pc).second) {
+                e.trial = id;
+                events.push_back(e);
+                added = true;
+            }
+        }
+        if (added) {
+            corpus.push_back(input);
+        }
+    }
+
+    // replaying takes as long as the trial did, outside the lock
+    for (Event& e : events) {
+        e.input = reproduce(input, e);
+        std::lock_guard<std::mutex> guard(lock);
+        found.push_back(e);
+    }
+}
+
+InputLog Fuzzer::reproduce(const InputLog& input, const Event& event) const {
+    InputLog log = settings;
+    log.seed = input.seed;
+
+    Target target;
+    Recorder recorder(target, log);
+    State state = power_on;
+    Chip8 chip(recorder, state);
+    chip.set_ipf(settings.ipf);
+    chip.set_platform(settings.platform);
+    chip.seed(input.seed);
+    target.start(input);
+
+    // through the frame the fault happened in
+    NoProfile none;
+    while (target.frames <= event.frame) {
+        chip.run_cached(0, none);
+    }
+    return log;
+}
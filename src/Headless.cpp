@@ -0,0 +1,19 @@
+#include "Headless.h"
+
+Headless::Headless() {}
+
+Headless::~Headless() {}
+
+// nothing to present
+void Headless::render(const Framebuffer&) {}
+
+// keys only change through set_key
+void Headless::poll() {}
+
+bool Headless::get_key_press(int idx) {
+    return key_pressed[idx];
+}
+
+void Headless::set_key(int idx, bool down) {
+    key_pressed[idx] = down;
+}
@@ -0,0 +1,25 @@
+#include <iostream>
+#include "Host.h"
+
+const char* Fault::name(Kind kind) {
+    switch (kind) {
+    case STACK_OVERFLOW: return "stack_overflow";
+    case STACK_UNDERFLOW: return "stack_underflow";
+    case UNKNOWN_INSTRUCTION: return "unknown_instruction";
+    }
+    return "";
+}
+
+void Host::fault(const Fault& f) {
+    switch (f.kind) {
+    case Fault::STACK_OVERFLOW:
+        std::cerr << "Stack Overflow in call2()\n";
+        break;
+    case Fault::STACK_UNDERFLOW:
+        std::cerr << "Stack Underflow Error in ret0()" << std::endl;
+        break;
+    case Fault::UNKNOWN_INSTRUCTION:
+        std::cerr << "Unknown instruction: 0x" << std::hex << f.instr << std::dec << "\n";
+        break;
+    }
+}
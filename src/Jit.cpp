@@ -0,0 +1,309 @@
+#include <cstring>
+#include "Jit.h"
+
+#if defined(__x86_64__)
+#include <sys/mman.h>
+#endif
+
+// longest run of instructions compiled into one block
+#define MAX_BLOCK 64
+// size of the executable code cache
+#define CODE_SIZE (1 << 20)
+
+Jit::Jit(Layout l, Quirks q) : layout(l), quirks(q) {
+#if defined(__x86_64__)
+    void* mem = mmap(nullptr, CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem != MAP_FAILED) {
+        code = static_cast<uint8_t*>(mem);
+        code_size = CODE_SIZE;
+    }
+#endif
+}
+
+Jit::~Jit() {
+#if defined(__x86_64__)
+    if (code != nullptr) {
+        munmap(code, code_size);
+        code = nullptr;
+    }
+#endif
+}
+
+bool Jit::available() {
+    return code != nullptr;
+}
+
+const Jit::Entry& Jit::lookup(uint16_t pc, const uint8_t* memory) {
+    Entry& entry = blocks[pc & 0xFFF];
+    if (entry.compiled || code == nullptr) {
+        return entry;
+    }
+
+    buf.clear();
+    blocks_loop = false;
+
+    // translate until something the interpreter has to handle
+    uint16_t addr = pc;
+    uint16_t count = 0;
+    bool ends_block = false;
+    while (!ends_block && count < MAX_BLOCK && addr < 4095) {
+        uint16_t instr = memory[addr] << 8 | memory[addr + 1];
+        size_t mark = buf.size();
+
+        // a frame boundary may fall anywhere inside the block
+        if (count > 0) {
+            emit_budget_check(addr, count);
+        }
+        if (!compile_instr(instr, addr, ends_block)) {
+            buf.resize(mark);
+            break;
+        }
+        addr += 2;
+        count++;
+    }
+
+    if (count > 0) {
+        // fell off the end of the block: continue at the next instruction
+        if (!ends_block) {
+            emit_set_pc(addr);
+        }
+        emit({ 0xB8 }); // mov eax, count
+        emit32(count);
+        emit({ 0xC3 }); // ret
+
+        if (code_used + buf.size() > code_size) {
+            flush();
+        }
+
+        memcpy(code + code_used, buf.data(), buf.size());
+        entry.fn = reinterpret_cast<Block>(code + code_used);
+        entry.count = count;
+        entry.loops = blocks_loop;
+        code_used += buf.size();
+
+        // remember which bytes this block depends on
+        for (uint16_t a = pc; a < addr; a++) {
+            in_block[a] = true;
+        }
+    }
+
+    entry.compiled = true;
+    return entry;
+}
+
+void Jit::invalidate(uint16_t addr) {
+    if (in_block[addr & 0xFFF]) {
+        flush();
+    }
+}
+
+// self-modifying code is rare, so any write into compiled code simply
+// throws the whole cache away
+void Jit::flush() {
+    for (int i = 0; i < 4096; i++) {
+        blocks[i] = Entry();
+        in_block[i] = false;
+    }
+    code_used = 0;
+}
+
+// -- Emitters
+
+void Jit::emit(std::initializer_list<uint8_t> bytes) {
+    buf.insert(buf.end(), bytes);
+}
+
+void Jit::emit32(int32_t value) {
+    for (int i = 0; i < 4; i++) {
+        buf.push_back((value >> (8 * i)) & 0xFF);
+    }
+}
+
+void Jit::emit16(uint16_t value) {
+    buf.push_back(value & 0xFF);
+    buf.push_back(value >> 8);
+}
+
+void Jit::emit_mem(std::initializer_list<uint8_t> op, int32_t disp) {
+    emit(op);
+    emit32(disp);
+}
+
+void Jit::emit_set_pc(uint16_t addr) {
+    emit_mem({ 0x66, 0xC7, 0x87 }, layout.pc); // mov word [pc], imm16
+    emit16(addr);
+}
+
+void Jit::emit_budget_check(uint16_t addr, uint16_t count) {
+    emit({ 0x83, 0xFE, uint8_t(count) }); // cmp esi, count
+    emit({ 0x75, 15 });                   // jne over the exit
+    emit_set_pc(addr);
+    emit({ 0xB8 });                       // mov eax, count
+    emit32(count);
+    emit({ 0xC3 });                       // ret
+}
+
+// the flags are already set: jump over the second store unless skipping
+void Jit::emit_skip(uint8_t jcc_no_skip, uint16_t next) {
+    emit_set_pc(next);
+    emit({ jcc_no_skip, 9 });
+    emit_set_pc(next + 2);
+}
+
+// register usage: rdi = machine, esi = budget, al/cl/dl scratch
+bool Jit::compile_instr(uint16_t instr, uint16_t addr, bool& ends_block) {
+    uint8_t x = (instr >> 8) & 0xF;
+    uint8_t y = (instr >> 4) & 0xF;
+    uint8_t n = instr & 0xF;
+    uint8_t nn = instr & 0xFF;
+    uint16_t nnn = instr & 0xFFF;
+
+    int32_t vx = layout.reg_v + x;
+    int32_t vy = layout.reg_v + y;
+    int32_t vf = layout.reg_v + 0xF;
+
+    switch (instr >> 12) {
+    case 0x1:
+        emit_set_pc(nnn);
+        ends_block = true;
+        blocks_loop = nnn <= addr;
+        return true;
+    case 0x3:
+        emit_mem({ 0x80, 0xBF }, vx); // cmp byte [vx], nn
+        emit({ nn });
+        emit_skip(0x75, addr + 2); // jne
+        ends_block = true;
+        return true;
+    case 0x4:
+        emit_mem({ 0x80, 0xBF }, vx); // cmp byte [vx], nn
+        emit({ nn });
+        emit_skip(0x74, addr + 2); // je
+        ends_block = true;
+        return true;
+    case 0x5:
+    case 0x9:
+        if (n != 0) {
+            return false;
+        }
+        emit_mem({ 0x8A, 0x87 }, vx); // mov al, [vx]
+        emit_mem({ 0x3A, 0x87 }, vy); // cmp al, [vy]
+        emit_skip((instr >> 12) == 0x5 ? 0x75 : 0x74, addr + 2);
+        ends_block = true;
+        return true;
+    case 0x6:
+        emit_mem({ 0xC6, 0x87 }, vx); // mov byte [vx], nn
+        emit({ nn });
+        return true;
+    case 0x7:
+        emit_mem({ 0x80, 0x87 }, vx); // add byte [vx], nn
+        emit({ nn });
+        return true;
+    case 0x8:
+        switch (n) {
+        case 0x0:
+            emit_mem({ 0x8A, 0x87 }, vy); // mov al, [vy]
+            emit_mem({ 0x88, 0x87 }, vx); // mov [vx], al
+            return true;
+        case 0x1:
+        case 0x2:
+        case 0x3:
+            emit_mem({ 0x8A, 0x87 }, vy); // mov al, [vy]
+            emit_mem({ uint8_t(n == 0x1 ? 0x08 : n == 0x2 ? 0x20 : 0x30), 0x87 }, vx); // or/and/xor [vx], al
+            if (quirks.vf_reset) {
+                emit_mem({ 0xC6, 0x87 }, vf); // mov byte [vf], 0
+                emit({ 0 });
+            }
+            return true;
+        case 0x4:
+            emit_mem({ 0x0F, 0xB6, 0x87 }, vx); // movzx eax, byte [vx]
+            emit_mem({ 0x0F, 0xB6, 0x8F }, vy); // movzx ecx, byte [vy]
+            emit({ 0x01, 0xC8 });               // add eax, ecx
+            emit({ 0x89, 0xC2 });               // mov edx, eax
+            emit({ 0xC1, 0xEA, 0x08 });         // shr edx, 8
+            emit_mem({ 0x88, 0x97 }, vf);       // mov [vf], dl
+            if (x != 0xF) {
+                emit_mem({ 0x88, 0x87 }, vx);   // mov [vx], al
+            }
+            return true;
+        case 0x5:
+        case 0x7:
+            emit_mem({ 0x8A, 0x87 }, vx); // mov al, [vx]
+            emit_mem({ 0x8A, 0x8F }, vy); // mov cl, [vy]
+            emit({ 0x38, 0xC8 });         // cmp al, cl
+            if (n == 0x5) {
+                emit({ 0x0F, 0x93, 0xC2 }); // setae dl
+                emit({ 0x28, 0xC8 });       // sub al, cl
+            } else {
+                emit({ 0x0F, 0x96, 0xC2 }); // setbe dl
+                emit({ 0x28, 0xC1 });       // sub cl, al
+            }
+            emit_mem({ 0x88, 0x97 }, vf); // mov [vf], dl
+            if (x != 0xF) {
+                emit_mem({ uint8_t(0x88), uint8_t(n == 0x5 ? 0x87 : 0x8F) }, vx); // mov [vx], al/cl
+            }
+            return true;
+        case 0x6:
+        case 0xE:
+            if (quirks.shift_vx) {
+                vy = vx;
+            }
+
+            // VF is written first and vy re-read, exactly like the interpreter
+            emit_mem({ 0x8A, 0x87 }, vy); // mov al, [vy]
+            if (n == 0x6) {
+                emit({ 0x24, 0x01 });       // and al, 1
+            } else {
+                emit({ 0xC0, 0xE8, 0x07 }); // shr al, 7
+            }
+            emit_mem({ 0x88, 0x87 }, vf); // mov [vf], al
+            if (x != 0xF) {
+                emit_mem({ 0x8A, 0x87 }, vy); // mov al, [vy]
+                emit({ 0xD0, uint8_t(n == 0x6 ? 0xE8 : 0xE0) }); // shr/shl al, 1
+                emit_mem({ 0x88, 0x87 }, vx); // mov [vx], al
+            }
+            return true;
+        }
+        return false;
+    case 0xA:
+        emit_mem({ 0x66, 0xC7, 0x87 }, layout.reg_i); // mov word [i], nnn
+        emit16(nnn);
+        return true;
+    case 0xF:
+        switch (nn) {
+        case 0x15:
+            emit_mem({ 0x8A, 0x87 }, vx); // mov al, [vx]
+            emit_mem({ 0x88, 0x87 }, layout.reg_t); // mov [t], al
+            return true;
+        // FX18 stays with the interpreter so the core sees the beeper turn on
+        case 0x1E:
+            emit_mem({ 0x0F, 0xB6, 0x87 }, vx);        // movzx eax, byte [vx]
+            emit_mem({ 0x66, 0x01, 0x87 }, layout.reg_i); // add word [i], ax
+            return true;
+        case 0x29:
+            emit_mem({ 0x0F, 0xB6, 0x87 }, vx);        // movzx eax, byte [vx]
+            emit({ 0x8D, 0x04, 0x80 });                // lea eax, [rax + rax * 4]
+            emit_mem({ 0x66, 0x89, 0x87 }, layout.reg_i); // mov word [i], ax
+            return true;
+        case 0x65:
+            for (int i = 0; i <= x; i++) {
+                emit_mem({ 0x0F, 0xB7, 0x8F }, layout.reg_i); // movzx ecx, word [i]
+                if (!quirks.memory_increment) {
+                    emit({ 0x83, 0xC1, uint8_t(i) });         // add ecx, i
+                }
+                emit({ 0x81, 0xE1 });                         // and ecx, 0xFFF
+                emit32(0xFFF);
+                emit_mem({ 0x8A, 0x84, 0x0F }, layout.memory); // mov al, [rdi + rcx + memory]
+                emit_mem({ 0x88, 0x87 }, layout.reg_v + i);    // mov [vi], al
+                if (quirks.memory_increment) {
+                    emit_mem({ 0x66, 0x83, 0x87 }, layout.reg_i); // add word [i], 1
+                    emit({ 1 });
+                }
+            }
+            return true;
+        }
+        return false;
+    }
+
+    // timers reads, keys, draws, stack, memory writes and rng stay interpreted
+    return false;
+}
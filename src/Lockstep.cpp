@@ -0,0 +1,432 @@
+#include <cstring>
+#include <iostream>
+#include "Font.h"
+#include "Lockstep.h"
+#include "Random.h"
+
+// dst = value in the lanes set in mask
+template <typename V>
+static inline void assign(V& dst, const V& mask, const V& value) {
+    dst = (value & mask) | (dst & ~mask);
+}
+
+// true if every element of a mask is set
+template <typename V>
+static inline bool all_set(const V& mask) {
+    uint64_t words[sizeof(V) / 8];
+    memcpy(words, &mask, sizeof(V));
+    uint64_t all = ~0ull;
+    for (size_t i = 0; i < sizeof(V) / 8; i++) {
+        all &= words[i];
+    }
+    return all == ~0ull;
+}
+
+template <int LANES>
+Lockstep<LANES>::Lockstep(Host& host, const std::vector<uint8_t>& rom, int ipf) : ipf(ipf), host(host) {
+    if (rom.empty()) {
+        std::cerr << "Error: Rom is empty\n";
+        throw - 3;
+    }
+
+    if (rom.size() > 4096 - 0x200) {
+        std::cerr << "Error: Rom size (" << rom.size() << ") too large to fit into memory\n";
+        throw - 4;
+    }
+
+    pc = Words{} + 0x200;
+    reg_i = Words{};
+    reg_t = Bytes{};
+    reg_s = Bytes{};
+    sp = Bytes{};
+    for (int r = 0; r < 16; r++) {
+        reg_v[r] = Bytes{};
+        stack[r] = Words{};
+    }
+
+    for (int l = 0; l < LANES; l++) {
+        memset(memory[l], 0, 4096);
+        memcpy(memory[l], FONT, FONT_SIZE);
+        memcpy(&memory[l][0x200], rom.data(), rom.size());
+        rng_state[l] = 0;
+        keys[l] = 0;
+        key_held[l] = 0;
+        key_wait[l] = false;
+    }
+}
+
+template <int LANES>
+Lockstep<LANES>::~Lockstep() {}
+
+template <int LANES>
+void Lockstep<LANES>::seed(int lane, uint64_t s) {
+    rng_state[lane] = s;
+}
+
+template <int LANES>
+void Lockstep<LANES>::set_key(int lane, int idx, bool down) {
+    if (down) {
+        keys[lane] |= 1 << idx;
+    } else {
+        keys[lane] &= ~(1 << idx);
+    }
+}
+
+template <int LANES>
+const Framebuffer& Lockstep<LANES>::framebuffer(int lane) const {
+    return frame[lane];
+}
+
+template <int LANES>
+Chip8::Registers Lockstep<LANES>::registers(int lane) const {
+    Chip8::Registers regs;
+    regs.pc = pc[lane];
+    regs.reg_i = reg_i[lane];
+    regs.sp = sp[lane];
+    for (int r = 0; r < 16; r++) {
+        regs.reg_v[r] = reg_v[r][lane];
+    }
+    regs.reg_t = reg_t[lane];
+    regs.reg_s = reg_s[lane];
+    return regs;
+}
+
+template <int LANES>
+void Lockstep<LANES>::run(uint64_t count) {
+    for (uint64_t s = 0; s < count; s++) {
+        // follow lane 0; everyone at the same pc runs with it
+        uint16_t lead = pc[0];
+        Words mask_w = (Words)(pc == lead);
+        bool vector = false;
+
+        // code nobody has written to is the same in every lane
+        if (lead < 4095 && !written[lead] && !written[lead + 1]) {
+            uint16_t instr = memory[0][lead] << 8 | memory[0][lead + 1];
+            Bytes mask = __builtin_convertvector(mask_w, Bytes);
+            vector = step_vector(instr, mask, mask_w);
+        }
+
+        if (!vector) {
+            for (int l = 0; l < LANES; l++) {
+                step_lane(l);
+            }
+        } else if (!all_set(mask_w)) {
+            for (int l = 0; l < LANES; l++) {
+                if (!mask_w[l]) {
+                    step_lane(l);
+                }
+            }
+        }
+
+        if (++steps % ipf == 0) {
+            tick();
+        }
+    }
+}
+
+template <int LANES>
+void Lockstep<LANES>::tick() {
+    reg_t -= (Bytes)(reg_t != 0) & 1;
+    reg_s -= (Bytes)(reg_s != 0) & 1;
+}
+
+template <int LANES>
+bool Lockstep<LANES>::step_vector(uint16_t instr, const Bytes& mask, const Words& mask_w) {
+    uint8_t x = (instr >> 8) & 0xF;
+    uint8_t y = (instr >> 4) & 0xF;
+    uint8_t n = instr & 0xF;
+    uint8_t nn = instr & 0xFF;
+    uint16_t nnn = instr & 0xFFF;
+
+    Bytes& vx = reg_v[x];
+    Bytes& vy = reg_v[y];
+    Bytes& vf = reg_v[0xF];
+    Words next = pc + 2;
+
+    switch (instr >> 12) {
+    case 0x1:
+        next = Words{} + nnn;
+        break;
+    case 0x3:
+        next += __builtin_convertvector((Bytes)(vx == nn), Words) & 2;
+        break;
+    case 0x4:
+        next += __builtin_convertvector((Bytes)(vx != nn), Words) & 2;
+        break;
+    case 0x5:
+        if (n != 0) return false;
+        next += __builtin_convertvector((Bytes)(vx == vy), Words) & 2;
+        break;
+    case 0x6:
+        assign(vx, mask, Bytes{} + nn);
+        break;
+    case 0x7:
+        assign(vx, mask, vx + nn);
+        break;
+    case 0x8:
+        switch (n) {
+        case 0x0:
+            assign(vx, mask, vy);
+            break;
+        case 0x1:
+        case 0x2:
+        case 0x3: {
+            Bytes result = n == 0x1 ? (vx | vy) : n == 0x2 ? (vx & vy) : (vx ^ vy);
+            assign(vx, mask, result);
+            assign(vf, mask, Bytes{});
+            break;
+        }
+        case 0x4: {
+            Bytes sum = vx + vy;
+            Bytes carry = (Bytes)(sum < vx) & 1;
+            assign(vf, mask, carry);
+            if (x != 0xF) assign(vx, mask, sum);
+            break;
+        }
+        case 0x5: {
+            Bytes diff = vx - vy;
+            Bytes flag = (Bytes)(vx >= vy) & 1;
+            assign(vf, mask, flag);
+            if (x != 0xF) assign(vx, mask, diff);
+            break;
+        }
+        case 0x7: {
+            Bytes diff = vy - vx;
+            Bytes flag = (Bytes)(vx <= vy) & 1;
+            assign(vf, mask, flag);
+            if (x != 0xF) assign(vx, mask, diff);
+            break;
+        }
+        // VF first, then vy is read again, same as Chip8::shr8/shl8
+        case 0x6:
+            assign(vf, mask, vy & 1);
+            if (x != 0xF) assign(vx, mask, Bytes(vy >> 1));
+            break;
+        case 0xE:
+            assign(vf, mask, Bytes(vy >> 7));
+            if (x != 0xF) assign(vx, mask, Bytes(vy << 1));
+            break;
+        default:
+            return false;
+        }
+        break;
+    case 0x9:
+        if (n != 0) return false;
+        next += __builtin_convertvector((Bytes)(vx != vy), Words) & 2;
+        break;
+    case 0xA:
+        assign(reg_i, mask_w, Words{} + nnn);
+        break;
+    case 0xB:
+        next = nnn + __builtin_convertvector(reg_v[0], Words);
+        break;
+    case 0xF:
+        switch (nn) {
+        case 0x07:
+            assign(vx, mask, reg_t);
+            break;
+        case 0x15:
+            assign(reg_t, mask, vx);
+            break;
+        case 0x18:
+            assign(reg_s, mask, vx);
+            break;
+        case 0x1E:
+            assign(reg_i, mask_w, reg_i + __builtin_convertvector(vx, Words));
+            break;
+        case 0x29:
+            assign(reg_i, mask_w, __builtin_convertvector(vx, Words) * 5);
+            break;
+        default:
+            return false;
+        }
+        break;
+    default:
+        return false;
+    }
+
+    assign(pc, mask_w, next);
+    vector_count += LANES;
+    return true;
+}
+
+// scalar fallback, mirrors the Chip8 instruction functions
+template <int LANES>
+void Lockstep<LANES>::step_lane(int l) {
+    uint16_t p = pc[l];
+    if (p >= 4096) {
+        return;
+    }
+
+    uint8_t* mem = memory[l];
+    uint16_t instr = mem[p] << 8 | mem[(p + 1) & 0xFFF];
+    pc[l] = p + 2;
+    lane_count++;
+
+    uint8_t x = (instr >> 8) & 0xF;
+    uint8_t y = (instr >> 4) & 0xF;
+    uint8_t n = instr & 0xF;
+    uint8_t nn = instr & 0xFF;
+    uint16_t nnn = instr & 0xFFF;
+
+    uint8_t vx = reg_v[x][l];
+    uint8_t vy = reg_v[y][l];
+
+    switch (instr >> 12) {
+    case 0x0:
+        if (instr == 0x00E0) {
+            frame[l].clear();
+        } else if (instr == 0x00EE) {
+            if (sp[l] == 0) {
+                host.fault({ Fault::STACK_UNDERFLOW, p, 0x00EE });
+                return;
+            }
+            sp[l]--;
+            pc[l] = stack[sp[l]][l];
+        }
+        return;
+    case 0x1:
+        pc[l] = nnn;
+        return;
+    case 0x2:
+        if (sp[l] >= 16) {
+            host.fault({ Fault::STACK_OVERFLOW, p, instr });
+            return;
+        }
+        stack[sp[l]][l] = pc[l];
+        sp[l]++;
+        pc[l] = nnn;
+        return;
+    case 0x3:
+        if (vx == nn) pc[l] += 2;
+        return;
+    case 0x4:
+        if (vx != nn) pc[l] += 2;
+        return;
+    case 0x5:
+        if (n == 0 && vx == vy) pc[l] += 2;
+        return;
+    case 0x6:
+        reg_v[x][l] = nn;
+        return;
+    case 0x7:
+        reg_v[x][l] = vx + nn;
+        return;
+    case 0x8:
+        switch (n) {
+        case 0x0: reg_v[x][l] = vy; return;
+        case 0x1: reg_v[x][l] = vx | vy; reg_v[0xF][l] = 0; return;
+        case 0x2: reg_v[x][l] = vx & vy; reg_v[0xF][l] = 0; return;
+        case 0x3: reg_v[x][l] = vx ^ vy; reg_v[0xF][l] = 0; return;
+        case 0x4:
+            reg_v[0xF][l] = (vx + vy) > 0xFF;
+            if (x != 0xF) reg_v[x][l] = vx + vy;
+            return;
+        case 0x5:
+            reg_v[0xF][l] = vx >= vy;
+            if (x != 0xF) reg_v[x][l] = vx - vy;
+            return;
+        case 0x6:
+            reg_v[0xF][l] = vy & 0x1;
+            if (x != 0xF) reg_v[x][l] = reg_v[y][l] >> 1;
+            return;
+        case 0x7:
+            reg_v[0xF][l] = vx <= vy;
+            if (x != 0xF) reg_v[x][l] = vy - vx;
+            return;
+        case 0xE:
+            reg_v[0xF][l] = vy >> 7;
+            if (x != 0xF) reg_v[x][l] = reg_v[y][l] << 1;
+            return;
+        }
+        break;
+    case 0x9:
+        if (n == 0 && vx != vy) pc[l] += 2;
+        return;
+    case 0xA:
+        reg_i[l] = nnn;
+        return;
+    case 0xB:
+        pc[l] = nnn + reg_v[0][l];
+        return;
+    case 0xC:
+        reg_v[x][l] = random_byte(rng_state[l]) & nn;
+        return;
+    case 0xD: {
+        reg_v[0xF][l] = 0;
+        uint8_t x0 = reg_v[x][l] % 64;
+        uint8_t y0 = reg_v[y][l] % 32;
+        bool collision = false;
+        for (int i = 0; i < n && y0 + i < 32; i++) {
+            collision |= frame[l].draw_row(x0, y0 + i, mem[(reg_i[l] + i) & 0xFFF]);
+        }
+        if (collision) {
+            reg_v[0xF][l] = 1;
+        }
+        return;
+    }
+    case 0xE:
+        if (nn == 0x9E) {
+            if (vx < 16 && (keys[l] >> vx) & 0x1) pc[l] += 2;
+            return;
+        }
+        if (nn == 0xA1) {
+            if (!(vx < 16 && (keys[l] >> vx) & 0x1)) pc[l] += 2;
+            return;
+        }
+        break;
+    case 0xF:
+        switch (nn) {
+        case 0x07: reg_v[x][l] = reg_t[l]; return;
+        case 0x0A: {
+            // same edge detection as Chip8::wait_key, the lane re-executes the
+            // FX0A instead of halting
+            if (!key_wait[l]) {
+                key_held[l] = keys[l];
+                key_wait[l] = true;
+            }
+            uint16_t fresh = keys[l] & ~key_held[l];
+            if (fresh) {
+                key_wait[l] = false;
+                reg_v[x][l] = __builtin_ctz(fresh);
+                return;
+            }
+            key_held[l] = keys[l];
+            pc[l] -= 2;
+            return;
+        }
+        case 0x15: reg_t[l] = vx; return;
+        case 0x18: reg_s[l] = vx; return;
+        case 0x1E: reg_i[l] += vx; return;
+        case 0x29: reg_i[l] = 5 * vx; return;
+        case 0x33:
+            for (int i = 0; i < 3; i++) {
+                uint16_t a = (reg_i[l] + i) & 0xFFF;
+                mem[a] = i == 0 ? vx / 100 : i == 1 ? (vx / 10) % 10 : vx % 10;
+                written[a] = true;
+            }
+            return;
+        case 0x55:
+            for (int i = 0; i <= x; i++) {
+                uint16_t a = reg_i[l] & 0xFFF;
+                mem[a] = reg_v[i][l];
+                written[a] = true;
+                reg_i[l]++;
+            }
+            return;
+        case 0x65:
+            for (int i = 0; i <= x; i++) {
+                reg_v[i][l] = mem[reg_i[l] & 0xFFF];
+                reg_i[l]++;
+            }
+            return;
+        }
+        break;
+    }
+
+    host.fault({ Fault::UNKNOWN_INSTRUCTION, p, instr });
+}
+
+template class Lockstep<8>;
+template class Lockstep<16>;
+template class Lockstep<32>;
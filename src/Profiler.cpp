@@ -0,0 +1,235 @@
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+#include "Profiler.h"
+
+Profiler::Profiler(Host& inner) : inner(inner) {}
+
+Profiler::~Profiler() {}
+
+// -- Host
+
+void Profiler::render(const Framebuffer& frame) {
+    Clock::time_point begin = Clock::now();
+    inner.render(frame);
+    render_time += Clock::now() - begin;
+}
+
+void Profiler::poll() {
+    inner.poll();
+    running = inner.running;
+}
+
+bool Profiler::get_key_press(int idx) {
+    return inner.get_key_press(idx);
+}
+
+void Profiler::beep(bool on, uint64_t cycle) {
+    inner.beep(on, cycle);
+}
+
+void Profiler::fault(const Fault& f) {
+    inner.fault(f);
+}
+
+// -- Functions
+
+Profiler::Class Profiler::classify(uint16_t instr) {
+    // same layout as Chip8::run_instr
+    switch (instr >> 12) {
+    case 0x0:
+        switch (instr) {
+        case 0x00E0: return CLS;
+        case 0x00EE: return RET;
+        default: return SYS;
+        }
+    case 0x1: return JP;
+    case 0x2: return CALL;
+    case 0x3: return SE_NN;
+    case 0x4: return SNE_NN;
+    case 0x5: return (instr & 0xF) == 0 ? SE_XY : UNKNOWN;
+    case 0x6: return LD_NN;
+    case 0x7: return ADD_NN;
+    case 0x8:
+        switch (instr & 0xF) {
+        case 0x0: return LD_XY;
+        case 0x1: return OR;
+        case 0x2: return AND;
+        case 0x3: return XOR;
+        case 0x4: return ADD_XY;
+        case 0x5: return SUB;
+        case 0x6: return SHR;
+        case 0x7: return SUBN;
+        case 0xE: return SHL;
+        }
+        break;
+    case 0x9: return (instr & 0xF) == 0 ? SNE_XY : UNKNOWN;
+    case 0xA: return LD_I;
+    case 0xB: return JP_V0;
+    case 0xC: return RND;
+    case 0xD: return DRW;
+    case 0xE:
+        switch (instr & 0xFF) {
+        case 0x9E: return SKP;
+        case 0xA1: return SKNP;
+        }
+        break;
+    case 0xF:
+        switch (instr & 0xFF) {
+        case 0x7: return LD_DT_READ;
+        case 0xA: return LD_KEY;
+        case 0x15: return LD_DT;
+        case 0x18: return LD_ST;
+        case 0x1E: return ADD_I;
+        case 0x29: return LD_FONT;
+        case 0x33: return BCD;
+        case 0x55: return STORE;
+        case 0x65: return LOAD;
+        }
+        break;
+    }
+    return UNKNOWN;
+}
+
+const char* Profiler::name(int cls) {
+    static const char* const NAMES[CLASS_COUNT] = {
+        "00E0", "00EE", "0NNN", "1NNN", "2NNN", "3XNN", "4XNN", "5XY0", "6XNN", "7XNN",
+        "8XY0", "8XY1", "8XY2", "8XY3", "8XY4", "8XY5", "8XY6", "8XY7", "8XYE", "9XY0",
+        "ANNN", "BNNN", "CXNN", "DXYN", "EX9E", "EXA1", "FX07", "FX0A", "FX15", "FX18",
+        "FX1E", "FX29", "FX33", "FX55", "FX65", "????"
+    };
+    return NAMES[cls];
+}
+
+uint64_t Profiler::total() const {
+    uint64_t sum = 0;
+    for (int i = 0; i < CLASS_COUNT; i++) {
+        sum += by_class[i];
+    }
+    return sum;
+}
+
+void Profiler::start() {
+    run_start = Clock::now();
+}
+
+void Profiler::stop() {
+    run_time += Clock::now() - run_start;
+}
+
+void Profiler::report(std::ostream& out) const {
+    typedef std::chrono::duration<double, std::milli> Millis;
+    double run_ms = Millis(run_time).count();
+    double render_ms = Millis(render_time).count();
+    double core_ms = run_ms - render_ms;
+    uint64_t count = std::max<uint64_t>(total(), 1);
+
+    out << std::fixed << std::setprecision(2);
+    out << "-- time\n";
+    out << "core:   " << core_ms << " ms (" << 100.0 * core_ms / std::max(run_ms, 1e-9) << "%)\n";
+    out << "render: " << render_ms << " ms (" << 100.0 * render_ms / std::max(run_ms, 1e-9) << "%)\n";
+
+    // classes by count, most executed first
+    std::vector<int> order;
+    for (int i = 0; i < CLASS_COUNT; i++) {
+        if (by_class[i] > 0) {
+            order.push_back(i);
+        }
+    }
+    std::sort(order.begin(), order.end(), [this](int a, int b) { return by_class[a] > by_class[b]; });
+
+    out << "-- opcodes (" << total() << " executed)\n";
+    for (int cls : order) {
+        out << name(cls) << "  " << std::setw(12) << by_class[cls] << "  " << std::setw(6) << 100.0 * by_class[cls] / count << "%\n";
+    }
+
+    // the hottest addresses
+    std::vector<int> hot;
+    for (int addr = 0; addr < 4096; addr++) {
+        if (by_pc[addr] > 0) {
+            hot.push_back(addr);
+        }
+    }
+    std::sort(hot.begin(), hot.end(), [this](int a, int b) { return by_pc[a] > by_pc[b]; });
+    if (hot.size() > 16) {
+        hot.resize(16);
+    }
+
+    out << "-- hot addresses\n";
+    for (int addr : hot) {
+        out << "0x" << std::hex << std::setw(3) << std::setfill('0') << addr << std::setfill(' ') << std::dec;
+        out << "  " << name(classify(instr_at[addr])) << "  " << std::setw(12) << by_pc[addr];
+        out << "  " << std::setw(6) << 100.0 * by_pc[addr] / count << "%\n";
+    }
+
+    out << "-- sprite heights\n";
+    for (int n = 0; n < 16; n++) {
+        if (by_height[n] > 0) {
+            out << std::setw(2) << n << "  " << std::setw(12) << by_height[n] << "\n";
+        }
+    }
+    // how often a fusable instruction ran as part of a superinstruction
+    if (fused_saved > 0) {
+        out << "-- fused (" << fused_saved << " dispatches saved)\n";
+        for (int cls = 0; cls < CLASS_COUNT; cls++) {
+            if (by_fused[cls] > 0) {
+                out << name(cls) << "  " << std::setw(12) << by_fused[cls];
+                out << "  " << std::setw(6) << 100.0 * by_fused[cls] / std::max<uint64_t>(by_class[cls], 1) << "%\n";
+            }
+        }
+    }
+    out << std::defaultfloat << std::flush;
+}
+
+void Profiler::write_csv(const char* fpath) const {
+    std::ofstream out(fpath);
+    if (!out) {
+        std::cerr << "Error: Failed to open file " << fpath << "\n";
+        throw - 6;
+    }
+
+    out << "kind,key,count\n";
+    out << "time_ns,core," << std::chrono::nanoseconds(run_time - render_time).count() << "\n";
+    out << "time_ns,render," << std::chrono::nanoseconds(render_time).count() << "\n";
+    for (int i = 0; i < CLASS_COUNT; i++) {
+        if (by_class[i] > 0) {
+            out << "opcode," << name(i) << "," << by_class[i] << "\n";
+        }
+    }
+    for (int addr = 0; addr < 4096; addr++) {
+        if (by_pc[addr] > 0) {
+            out << "pc,0x" << std::hex << addr << std::dec << "," << by_pc[addr] << "\n";
+        }
+    }
+    for (int n = 0; n < 16; n++) {
+        if (by_height[n] > 0) {
+            out << "height," << n << "," << by_height[n] << "\n";
+        }
+    }
+    for (int i = 0; i < CLASS_COUNT; i++) {
+        if (by_fused[i] > 0) {
+            out << "fused," << name(i) << "," << by_fused[i] << "\n";
+        }
+    }
+}
+
+void Profiler::write_collapsed(const char* fpath) const {
+    std::ofstream out(fpath);
+    if (!out) {
+        std::cerr << "Error: Failed to open file " << fpath << "\n";
+        throw - 6;
+    }
+
+    // weights are nanoseconds so core and render share one scale
+    double core_ns = std::chrono::duration<double, std::nano>(run_time - render_time).count();
+    double per_instr = core_ns / std::max<uint64_t>(total(), 1);
+    for (int addr = 0; addr < 4096; addr++) {
+        uint64_t ns = uint64_t(by_pc[addr] * per_instr);
+        if (ns > 0) {
+            out << "core;" << name(classify(instr_at[addr])) << ";0x" << std::hex << addr << std::dec << " " << ns << "\n";
+        }
+    }
+    out << "render " << std::chrono::nanoseconds(render_time).count() << "\n";
+}
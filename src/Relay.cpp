@@ -0,0 +1,68 @@
+#include "Relay.h"
+
+Relay::Relay() {}
+
+Relay::~Relay() {}
+
+// -- Host (core thread)
+
+void Relay::render(const Framebuffer& frame) {
+    for (int y = 0; y < BUF_HEIGHT; y++) {
+        buffers[back].rows[y] = frame.rows[y];
+    }
+
+    // swap the finished buffer into the middle, take the old middle back
+    back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & 0x3;
+
+    latched = keys.load(std::memory_order_relaxed);
+
+    if (on_frame) {
+        on_frame();
+    }
+}
+
+void Relay::poll() {}
+
+bool Relay::get_key_press(int idx) {
+    return idx < 16 && ((latched >> idx) & 0x1);
+}
+
+void Relay::beep(bool on, uint64_t cycle) {
+    if (on_beep) {
+        on_beep(on, cycle);
+    }
+}
+
+// -- Display thread
+
+bool Relay::fetch(Framebuffer& out) {
+    if ((middle.load(std::memory_order_relaxed) & FRESH) == 0) {
+        return false;
+    }
+    front = middle.exchange(front, std::memory_order_acq_rel) & 0x3;
+
+    // frames in between may have been skipped, so diff against what the
+    // display last had instead of trusting the core's dirty mask
+    const Framebuffer& frame = buffers[front];
+    for (int y = 0; y < BUF_HEIGHT; y++) {
+        if (out.rows[y] != frame.rows[y]) {
+            out.dirty |= 1u << y;
+            out.rows[y] = frame.rows[y];
+        }
+    }
+    return true;
+}
+
+void Relay::set_keys(uint16_t mask) {
+    keys.store(mask, std::memory_order_relaxed);
+}
+
+// -- Shutdown
+
+void Relay::stop() {
+    stopped.store(true);
+}
+
+bool Relay::is_stopped() const {
+    return stopped.load();
+}
@@ -0,0 +1,245 @@
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include "Replay.h"
+
+#define LOG_MAGIC "C8IN"
+#define LOG_VERSION 1
+
+// -- Encoding
+
+static void put_varint(std::vector<uint8_t>& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    out.push_back(value);
+}
+
+static void put_u64(std::vector<uint8_t>& out, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        out.push_back((value >> (8 * i)) & 0xFF);
+    }
+}
+
+// reads past the end of a truncated log fail instead of wrapping around
+static bool get_varint(const std::vector<uint8_t>& in, size_t& pos, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; pos < in.size() && shift < 64; shift += 7) {
+        uint8_t byte = in[pos++];
+        value |= uint64_t(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool get_u64(const std::vector<uint8_t>& in, size_t& pos, uint64_t& value) {
+    if (in.size() - pos < 8) {
+        return false;
+    }
+    value = 0;
+    for (int i = 0; i < 8; i++) {
+        value |= uint64_t(in[pos++]) << (8 * i);
+    }
+    return true;
+}
+
+// -- InputLog
+
+void InputLog::save(const char* fpath) const {
+    std::vector<uint8_t> out(LOG_MAGIC, LOG_MAGIC + 4);
+    put_varint(out, LOG_VERSION);
+    put_varint(out, seed);
+    put_varint(out, ipf);
+    put_varint(out, platform);
+    put_u64(out, rom_hash);
+    put_varint(out, frames);
+
+    // frames as deltas from the previous entry
+    put_varint(out, keys.size());
+    uint64_t prev = 0;
+    for (const Keys& k : keys) {
+        put_varint(out, k.frame - prev);
+        put_varint(out, k.mask);
+        prev = k.frame;
+    }
+
+    put_varint(out, checks.size());
+    prev = 0;
+    for (const Check& c : checks) {
+        put_varint(out, c.frame - prev);
+        put_u64(out, c.hash);
+        prev = c.frame;
+    }
+
+    std::ofstream file(fpath, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(out.data()), out.size());
+    if (!file) {
+        std::cerr << "Error: Failed to write file " << fpath << "\n";
+        throw - 7;
+    }
+}
+
+void InputLog::load(const char* fpath) {
+    std::ifstream file(fpath, std::ios::binary);
+    if (!file) {
+        std::cerr << "Error: Failed to open file " << fpath << "\n";
+        throw - 7;
+    }
+    std::vector<uint8_t> in((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    size_t pos = 4;
+    uint64_t version = 0;
+    uint64_t value = 0;
+    bool ok = in.size() >= 4 && std::equal(in.begin(), in.begin() + 4, LOG_MAGIC) &&
+        get_varint(in, pos, version) && version == LOG_VERSION &&
+        get_varint(in, pos, seed) &&
+        get_varint(in, pos, value) && value > 0 && value <= 0xFFFF;
+    ipf = int(value);
+    ok = ok && get_varint(in, pos, value) && value <= MODERN;
+    platform = Platform(value);
+    ok = ok && get_u64(in, pos, rom_hash) && get_varint(in, pos, frames);
+
+    uint64_t count = 0;
+    uint64_t frame = 0;
+    keys.clear();
+    ok = ok && get_varint(in, pos, count);
+    for (uint64_t i = 0; ok && i < count; i++) {
+        uint64_t delta = 0;
+        ok = get_varint(in, pos, delta) && get_varint(in, pos, value) && value <= 0xFFFF;
+        frame += delta;
+        keys.push_back({ frame, uint16_t(value) });
+    }
+
+    frame = 0;
+    checks.clear();
+    ok = ok && get_varint(in, pos, count);
+    for (uint64_t i = 0; ok && i < count; i++) {
+        uint64_t delta = 0;
+        ok = get_varint(in, pos, delta) && get_u64(in, pos, value);
+        frame += delta;
+        checks.push_back({ frame, value });
+    }
+
+    if (!ok || pos != in.size()) {
+        std::cerr << "Error: " << fpath << " is not a valid input log\n";
+        throw - 8;
+    }
+}
+
+uint64_t InputLog::hash_file(const char* fpath) {
+    std::ifstream file(fpath, std::ios::binary);
+    if (!file) {
+        std::cerr << "Error: Failed to open file " << fpath << "\n";
+        throw - 2;
+    }
+
+    std::vector<uint8_t> rom((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    return hash_rom(rom.data(), rom.size());
+}
+
+uint64_t InputLog::hash_rom(const uint8_t* rom, size_t size) {
+    uint64_t h = 0xcbf29ce484222325;
+    for (size_t i = 0; i < size; i++) {
+        h ^= rom[i];
+        h *= 0x100000001b3;
+    }
+    return h;
+}
+
+// -- Recorder
+
+Recorder::Recorder(Host& inner, InputLog& log) : inner(inner), log(log), last_hash(Framebuffer().hash()) {}
+
+Recorder::~Recorder() {}
+
+void Recorder::render(const Framebuffer& frame) {
+    inner.render(frame);
+    log.frames++;
+
+    // an untouched screen can't have a new hash
+    if (frame.dirty != 0) {
+        uint64_t hash = frame.hash();
+        if (hash != last_hash) {
+            log.checks.push_back({ log.frames, hash });
+            last_hash = hash;
+        }
+    }
+
+    // latch the keys for the next frame
+    uint16_t mask = 0;
+    for (int k = 0; k < 16; k++) {
+        mask |= inner.get_key_press(k) << k;
+    }
+    if (mask != keys) {
+        log.keys.push_back({ log.frames, mask });
+        keys = mask;
+    }
+}
+
+void Recorder::poll() {
+    inner.poll();
+    running = inner.running;
+}
+
+bool Recorder::get_key_press(int idx) {
+    return idx < 16 && ((keys >> idx) & 0x1);
+}
+
+void Recorder::beep(bool on, uint64_t cycle) {
+    inner.beep(on, cycle);
+}
+
+void Recorder::fault(const Fault& f) {
+    inner.fault(f);
+}
+
+// -- Replayer
+
+Replayer::Replayer(const InputLog& log) : log(log), expected(Framebuffer().hash()) {
+    // keys held from power on
+    if (!log.keys.empty() && log.keys[0].frame == 0) {
+        keys = log.keys[0].mask;
+        next_keys = 1;
+    }
+}
+
+Replayer::~Replayer() {}
+
+void Replayer::render(const Framebuffer& frame) {
+    frames++;
+
+    bool check = frame.dirty != 0;
+    while (next_check < log.checks.size() && log.checks[next_check].frame <= frames) {
+        expected = log.checks[next_check++].hash;
+        check = true;
+    }
+    if (check && mismatch == 0 && frame.hash() != expected) {
+        mismatch = frames;
+    }
+
+    while (next_keys < log.keys.size() && log.keys[next_keys].frame <= frames) {
+        keys = log.keys[next_keys++].mask;
+    }
+}
+
+void Replayer::poll() {}
+
+bool Replayer::get_key_press(int idx) {
+    return idx < 16 && ((keys >> idx) & 0x1);
+}
+
+bool Replayer::done() const {
+    return frames >= log.frames;
+}
+
+uint64_t Replayer::frame() const {
+    return frames;
+}
+
+uint64_t Replayer::first_mismatch() const {
+    return mismatch;
+}
@@ -0,0 +1,124 @@
+#include <cstring>
+#include "Rewind.h"
+
+// frames per keyframe, about one second
+#define KEYFRAME_INTERVAL 60
+
+Rewind::Rewind(size_t budget) : budget(budget) {}
+
+Rewind::~Rewind() {}
+
+void Rewind::push(const State& frame) {
+    if (segments.empty() || segments.back().deltas.size() + 1 >= KEYFRAME_INTERVAL) {
+        segments.emplace_back();
+        segments.back().key = frame;
+        used += sizeof(State);
+    } else {
+        Segment& seg = segments.back();
+        seg.deltas.emplace_back();
+        encode(seg.key, frame, seg.deltas.back());
+        used += seg.deltas.back().size();
+    }
+
+    // forget the oldest second of history once over budget
+    while (used > budget && segments.size() > 1) {
+        Segment& old = segments.front();
+        used -= sizeof(State);
+        for (const std::vector<uint8_t>& delta : old.deltas) {
+            used -= delta.size();
+        }
+        segments.pop_front();
+    }
+}
+
+bool Rewind::pop(State& frame) {
+    if (segments.empty()) {
+        return false;
+    }
+
+    Segment& seg = segments.back();
+    if (seg.deltas.empty()) {
+        frame = seg.key;
+        used -= sizeof(State);
+        segments.pop_back();
+    } else {
+        decode(seg.key, seg.deltas.back(), frame);
+        used -= seg.deltas.back().size();
+        seg.deltas.pop_back();
+    }
+    return true;
+}
+
+size_t Rewind::size() const {
+    size_t frames = 0;
+    for (const Segment& seg : segments) {
+        frames += 1 + seg.deltas.size();
+    }
+    return frames;
+}
+
+size_t Rewind::bytes() const {
+    return used;
+}
+
+// -- Delta coding
+
+void Rewind::put_varint(std::vector<uint8_t>& out, size_t value) {
+    while (value >= 0x80) {
+        out.push_back((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    out.push_back(value);
+}
+
+size_t Rewind::get_varint(const std::vector<uint8_t>& in, size_t& pos) {
+    size_t value = 0;
+    for (int shift = 0; pos < in.size(); shift += 7) {
+        uint8_t byte = in[pos++];
+        value |= size_t(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            break;
+        }
+    }
+    return value;
+}
+
+void Rewind::encode(const State& key, const State& frame, std::vector<uint8_t>& out) {
+    const uint8_t* a = reinterpret_cast<const uint8_t*>(&key);
+    const uint8_t* b = reinterpret_cast<const uint8_t*>(&frame);
+    size_t i = 0;
+
+    while (i < sizeof(State)) {
+        size_t zeros = i;
+        while (i < sizeof(State) && a[i] == b[i]) {
+            i++;
+        }
+        zeros = i - zeros;
+
+        size_t start = i;
+        while (i < sizeof(State) && a[i] != b[i]) {
+            i++;
+        }
+
+        put_varint(out, zeros);
+        put_varint(out, i - start);
+        for (size_t j = start; j < i; j++) {
+            out.push_back(a[j] ^ b[j]);
+        }
+    }
+}
+
+void Rewind::decode(const State& key, const std::vector<uint8_t>& in, State& frame) {
+    memcpy(&frame, &key, sizeof(State));
+    uint8_t* out = reinterpret_cast<uint8_t*>(&frame);
+    size_t pos = 0;
+    size_t i = 0;
+
+    while (pos < in.size() && i < sizeof(State)) {
+        i += get_varint(in, pos);
+        size_t literals = get_varint(in, pos);
+        for (size_t j = 0; j < literals && i < sizeof(State) && pos < in.size(); j++) {
+            out[i++] ^= in[pos++];
+        }
+    }
+}
@@ -1,6 +1,40 @@
+#include <cstring>
 #include "Window.h"
 
+// every byte of a framebuffer row expanded to 8 RGB332 pixels
+struct Unpack_Lut {
+    uint64_t pixels[256];
+
+    Unpack_Lut() {
+        for (int byte = 0; byte < 256; byte++) {
+            uint8_t row[8];
+            for (int bit = 0; bit < 8; bit++) {
+                row[bit] = ((byte >> (7 - bit)) & 0x1) ? ON : OFF;
+            }
+            memcpy(&pixels[byte], row, 8);
+        }
+    }
+};
+
+static const Unpack_Lut UNPACK_LUT;
+
+// scancode of a letter or digit on a US layout, SDL_SCANCODE_UNKNOWN otherwise
+static SDL_Scancode scancode_of(char c) {
+    if (c >= 'a' && c <= 'z') {
+        return SDL_Scancode(SDL_SCANCODE_A + (c - 'a'));
+    }
+    if (c >= '1' && c <= '9') {
+        return SDL_Scancode(SDL_SCANCODE_1 + (c - '1'));
+    }
+    if (c == '0') {
+        return SDL_SCANCODE_0;
+    }
+    return SDL_SCANCODE_UNKNOWN;
+}
+
 Window::Window() {
+    set_layout(KEY_LAYOUT);
+
     if (!this->init_sdl()) {
         this->close_sdl();
         throw - 1;
@@ -68,13 +102,16 @@ bool Window::init_sdl() {
     // Set the render target
     SDL_SetRenderTarget(renderer, texture);
 
+    // lets the emulation thread interrupt wait()
+    wake_event = SDL_RegisterEvents(1);
+
     // if everything ran successfully return true
     return true;
 }
 
 void Window::close_sdl() {
     if (pixel_buffer != nullptr) {
-        delete pixel_buffer;
+        delete[] pixel_buffer;
         pixel_buffer = nullptr;
     }
     if (texture) {
@@ -95,73 +132,115 @@ void Window::close_sdl() {
     SDL_Quit();
 }
 
-bool Window::get_pixel(int x, int y) {
-    return pixel_buffer[y * BUF_WIDTH + x] == ON;
-}
-
-void Window::set_pixel(int x, int y, bool on) {
-    pixel_buffer[y * BUF_WIDTH + x] = on ? ON : OFF;
+// 8 pixels per table lookup and store
+void Window::unpack(const Framebuffer& frame, int first, int last) {
+    for (int y = first; y <= last; y++) {
+        uint64_t row = frame.rows[y];
+        uint8_t* out = pixel_buffer + y * BUF_WIDTH;
+        for (int i = 0; i < 8; i++) {
+            uint8_t byte = (row >> (56 - 8 * i)) & 0xFF;
+            memcpy(out + 8 * i, &UNPACK_LUT.pixels[byte], 8);
+        }
+    }
 }
 
-void Window::clear_pixels() {
-    for (int i = 0; i < (BUF_WIDTH * BUF_HEIGHT); i++) {
-        pixel_buffer[i] = OFF;
-
+void Window::render(const Framebuffer& frame) {
+    if (frame.dirty != 0) {
+        // upload the span from the first to the last changed row
+        int first = __builtin_ctz(frame.dirty);
+        int last = 31 - __builtin_clz(frame.dirty);
+        unpack(frame, first, last);
+
+        SDL_Rect span = { 0, first, BUF_WIDTH, last - first + 1 };
+        SDL_UpdateTexture(texture, &span, pixel_buffer + first * BUF_WIDTH, BUF_WIDTH);
+    } else if (!exposed) {
+        // same picture as last time
+        return;
     }
-}
 
-void Window::render() {
-    SDL_UpdateTexture(texture, nullptr, pixel_buffer, BUF_WIDTH);
     SDL_RenderCopy(renderer, texture, nullptr, nullptr);
     SDL_RenderPresent(renderer);
+    exposed = false;
 }
 
-void Window::poll() {
-    while (SDL_PollEvent(&event)) {
-        switch (event.type) {
-        case SDL_QUIT:
+void Window::handle(const SDL_Event& e) {
+    switch (e.type) {
+    case SDL_QUIT:
+        running = false;
+        break;
+    case SDL_WINDOWEVENT:
+        if (e.window.event == SDL_WINDOWEVENT_EXPOSED || e.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
+            exposed = true;
+        }
+        break;
+    case SDL_KEYDOWN:
+    case SDL_KEYUP: {
+        bool down = e.type == SDL_KEYDOWN;
+        int code = e.key.keysym.scancode;
+        uint8_t binding = (code >= 0 && code < SDL_NUM_SCANCODES) ? bindings[code] : UNBOUND;
+
+        if (binding < 16) {
+            keys = down ? keys | (1 << binding) : keys & ~(1 << binding);
+        } else if (binding == REWIND) {
+            rewinding = down;
+        } else if (binding == QUIT && down) {
             running = false;
-            break;
-        case SDL_KEYDOWN:
-            if (event.key.keysym.sym == SDLK_ESCAPE) {
-                running = false;
-            } else {
-                auto key = KEY_MAP.find(event.key.keysym.sym);
-                if (key != KEY_MAP.end()) {
-                    key_pressed[key->second] = 1;
-                }
-            }
-            break;
-        case SDL_KEYUP:
-            auto key = KEY_MAP.find(event.key.keysym.sym);
-            if (key != KEY_MAP.end()) {
-                key_pressed[key->second] = 0;
-            }
         }
+        break;
+    }
     }
 }
 
-uint8_t Window::await_keypress() {
+void Window::poll() {
     while (SDL_PollEvent(&event)) {
-        switch (event.type) {
-        case SDL_QUIT:
-            running = false;
-            return 0xFF;
-        case SDL_KEYDOWN:
-            if (event.key.keysym.sym == SDLK_ESCAPE) {
-                running = false;
-                return 0xFF;
-            } else {
-                auto key = KEY_MAP.find(event.key.keysym.sym);
-                if (key != KEY_MAP.end()) {
-                    return key->second;
-                }
-            }
-        }
+        handle(event);
+    }
+}
+
+void Window::wait(int timeout_ms) {
+    if (SDL_WaitEventTimeout(&event, timeout_ms)) {
+        handle(event);
+    }
+    poll();
+}
+
+void Window::wake() {
+    if (wake_event == (Uint32)-1) {
+        return;
     }
-    return 0xFE;
+    SDL_Event e;
+    SDL_zero(e);
+    e.type = wake_event;
+    SDL_PushEvent(&e);
 }
 
 bool Window::get_key_press(int idx) {
-    return key_pressed[idx];
+    return (keys >> idx) & 0x1;
+}
+
+uint16_t Window::key_mask() const {
+    return keys;
+}
+
+bool Window::set_layout(const char* layout) {
+    if (strlen(layout) != 16) {
+        return false;
+    }
+
+    uint8_t table[SDL_NUM_SCANCODES];
+    memset(table, UNBOUND, sizeof(table));
+    table[SDL_SCANCODE_ESCAPE] = QUIT;
+    table[SDL_SCANCODE_BACKSPACE] = REWIND;
+
+    for (int k = 0; k < 16; k++) {
+        SDL_Scancode code = scancode_of(layout[k]);
+        if (code == SDL_SCANCODE_UNKNOWN || table[code] != UNBOUND) {
+            return false;
+        }
+        table[code] = k;
+    }
+
+    memcpy(bindings, table, sizeof(bindings));
+    keys = 0;
+    return true;
 }
@@ -1,29 +1,537 @@
 #include "Window.h"
+#include "Audio.h"
+#include "Aot.h"
+#include "Headless.h"
 #include "Chip8.h"
+#include "Analysis.h"
+#include "Batch.h"
+#include "Fuzzer.h"
+#include "Lockstep.h"
+#include "Relay.h"
+#include "Replay.h"
+#include "Rewind.h"
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
 #include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+
+struct Options {
+    const char* rom = nullptr;
+    bool headless = false;
+    bool diff = false;
+    Chip8::Engine engine = Chip8::INTERPRETER;
+    uint64_t cycles = 1000000;
+    int ipf = 16;
+    bool idle = true;
+    bool cycle_skip = false;
+    Platform platform = VIP;
+    const char* profile = nullptr;
+    unsigned batch = 0;
+    unsigned lanes = 0;
+    const char* keys = nullptr;
+    const char* record = nullptr;
+    const char* replay = nullptr;
+    bool analyze = false;
+    const char* aot = nullptr;
+    uint64_t fuzz = 0;
+};
+
+// Advance the machine with the chosen engine, returns instructions executed
+template <class P>
+static int step(Chip8& chip, Chip8::Engine engine, P& profile) {
+    switch (engine) {
+    case Chip8::CACHED:
+        return chip.run_cached(0, profile);
+    case Chip8::JIT:
+        return chip.run_jit();
+    case Chip8::THREADED:
+        return chip.run_threaded();
+    case Chip8::AOT:
+        return chip.run_aot();
+    default:
+        return chip.run(profile);
+    }
+}
+
+// Run until the budget is spent, skipped idle cycles count towards it
+template <class P>
+static uint64_t run_for(Chip8& chip, const Options& opt, P& profile) {
+    uint64_t executed = 0;
+    while (executed + chip.skipped() < opt.cycles) {
+        executed += step(chip, opt.engine, profile);
+    }
+    return executed + chip.skipped();
+}
+
+// Write the profile as a report on stdout plus <prefix>.csv and <prefix>.folded
+static void write_profile(const Profiler& profiler, const char* prefix) {
+    profiler.report(std::cout);
+    profiler.write_csv((std::string(prefix) + ".csv").c_str());
+    profiler.write_collapsed((std::string(prefix) + ".folded").c_str());
+}
+
+// Decode or compile everything reachable before the first frame
+static void warm(Chip8& chip, const Options& opt) {
+    if (opt.engine == Chip8::CACHED || opt.engine == Chip8::JIT || opt.engine == Chip8::AOT) {
+        chip.prepare(Analysis(Batch::load(opt.rom)), opt.engine);
+    }
+}
+
+// Open the library chip8-aot built for this rom and platform, nullptr if
+// there is none or the engine isn't AOT
+static std::unique_ptr<Aot> load_aot(const Options& opt, Platform platform) {
+    if (opt.engine != Chip8::AOT) {
+        return nullptr;
+    }
+
+    uint64_t hash = InputLog::hash_file(opt.rom);
+    std::string path = std::string(opt.aot) + "/" + Aot::file_name(hash, platform);
+    std::unique_ptr<Aot> aot(new Aot(path.c_str(), hash, platform));
+    if (!aot->available()) {
+        std::cerr << "Note: no compiled code for " << opt.rom << ", running through the cache\n";
+        return nullptr;
+    }
+    return aot;
+}
+
+// Attach it to a machine; without one the AOT engine runs through the
+// cache. The library has to outlive the machine's last run.
+static std::unique_ptr<Aot> open_aot(Chip8& chip, const Options& opt, Platform platform) {
+    std::unique_ptr<Aot> aot = load_aot(opt, platform);
+    if (aot != nullptr) {
+        chip.attach(aot.get());
+    }
+    return aot;
+}
+
+// Start a recording: a fresh rng seed for this session plus the settings a
+// replay needs
+static void begin_log(InputLog& log, Chip8& chip, const Options& opt) {
+    std::random_device device;
+    log.seed = uint64_t(device()) << 32 | device();
+    log.ipf = opt.ipf;
+    log.platform = opt.platform;
+    log.rom_hash = InputLog::hash_file(opt.rom);
+    chip.seed(log.seed);
+}
+
+// Run a rom with no window for a fixed number of instructions and report
+// the final framebuffer and how fast the core went
+static int run_headless(const Options& opt) {
+    Headless host = Headless();
+    InputLog log;
+    Recorder recorder(host, log);
+    Host& inner = opt.record ? static_cast<Host&>(recorder) : host;
+    Profiler profiler(inner);
+    Chip8 chip(opt.profile ? static_cast<Host&>(profiler) : inner, opt.rom);
+    chip.set_ipf(opt.ipf);
+    chip.set_idle_skip(opt.idle);
+    chip.set_platform(opt.platform);
+    if (opt.record) {
+        begin_log(log, chip, opt);
+    }
+    std::unique_ptr<Aot> aot = open_aot(chip, opt, opt.platform);
+    warm(chip, opt);
+
+    // skipped frames never reach the host, a recording needs every one
+    if (opt.cycle_skip && !opt.record) {
+        chip.set_cycle_skip(opt.cycles);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    uint64_t executed = 0;
+    if (opt.profile) {
+        profiler.start();
+        executed = run_for(chip, opt, profiler);
+        profiler.stop();
+    } else {
+        NoProfile none;
+        executed = run_for(chip, opt, none);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::cout << "hash: 0x" << std::hex << chip.framebuffer().hash() << std::dec << "\n";
+    std::cout << "cycles: " << executed << "\n";
+    std::cout << "skipped: " << chip.skipped() << "\n";
+    std::cout << "ips: " << uint64_t(executed / elapsed.count()) << std::endl;
+
+    if (opt.profile) {
+        write_profile(profiler, opt.profile);
+    }
+    if (opt.record) {
+        log.save(opt.record);
+    }
+    return 0;
+}
+
+// Play an input log back with no window and no pacing, checking every
+// frame's hash against the recording
+static int run_replay(const Options& opt) {
+    InputLog log;
+    log.load(opt.replay);
+    if (log.rom_hash != InputLog::hash_file(opt.rom)) {
+        std::cerr << "Error: " << opt.replay << " was recorded with a different rom\n";
+        return 1;
+    }
+
+    Replayer host(log);
+    Chip8 chip(host, opt.rom);
+    chip.set_ipf(log.ipf);
+    chip.set_idle_skip(opt.idle);
+    chip.set_platform(log.platform);
+    chip.seed(log.seed);
+    std::unique_ptr<Aot> aot = open_aot(chip, opt, log.platform);
+    warm(chip, opt);
+
+    auto start = std::chrono::steady_clock::now();
+    NoProfile none;
+    while (!host.done() && host.first_mismatch() == 0) {
+        step(chip, opt.engine, none);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::cout << "frames: " << host.frame() << "\n";
+    std::cout << "hash: 0x" << std::hex << chip.framebuffer().hash() << std::dec << "\n";
+    std::cout << "speed: " << uint64_t(host.frame() / 60.0 / elapsed.count()) << "x realtime\n";
+    if (host.first_mismatch() != 0) {
+        std::cout << "mismatch at frame " << host.first_mismatch() << std::endl;
+        return 1;
+    }
+    std::cout << "replay matches" << std::endl;
+    return 0;
+}
+
+// Run the recompiler and the interpreter in lockstep and stop at the first
+// block after which their states differ
+static int run_diff(const Options& opt) {
+    Headless jit_host = Headless();
+    Headless ref_host = Headless();
+    Chip8 jit(jit_host, opt.rom);
+    Chip8 ref(ref_host, opt.rom);
+    jit.set_ipf(opt.ipf);
+    ref.set_ipf(opt.ipf);
+    jit.set_platform(opt.platform);
+    ref.set_platform(opt.platform);
+
+    uint64_t executed = 0;
+    while (executed < opt.cycles) {
+        // one instruction at a time, each ticking, so a block that ran past
+        // a frame boundary shows up
+        int count = jit.run_jit();
+        for (int done = 0; done < count;) {
+            done += ref.run();
+        }
+        executed += count;
+
+        if (!jit.same_state(ref)) {
+            std::cout << "mismatch after " << executed << " instructions\n";
+            std::cout << "-- jit\n";
+            jit.register_dump();
+            std::cout << "-- interpreter\n";
+            ref.register_dump();
+            return 1;
+        }
+    }
+
+    std::cout << "no mismatch in " << executed << " instructions" << std::endl;
+    return 0;
+}
+
+// Fuzz the rom's key timelines and rng seeds for opt.fuzz trials of
+// opt.cycles instructions each and report every fault found, with --record
+// saving a log that replays up to each one
+static int run_fuzz(const Options& opt) {
+    uint64_t frames = opt.cycles / std::max(opt.ipf, 1);
+    Fuzzer fuzzer(Batch::load(opt.rom), InputLog::hash_file(opt.rom), opt.ipf, opt.platform, frames);
+
+    auto start = std::chrono::steady_clock::now();
+    fuzzer.run(opt.fuzz);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    const std::vector<Fuzzer::Event>& events = fuzzer.events();
+    for (size_t i = 0; i < events.size(); i++) {
+        const Fuzzer::Event& e = events[i];
+        std::cout << "fault " << Fault::name(e.fault.kind) << " pc 0x" << std::hex << e.fault.pc;
+        std::cout << " instr 0x" << std::setw(4) << std::setfill('0') << e.fault.instr << std::setfill(' ') << std::dec;
+        std::cout << " frame " << e.frame << " trial " << e.trial;
+        if (opt.record) {
+            std::string path = std::string(opt.record) + "-" + std::to_string(i) + ".log";
+            e.input.save(path.c_str());
+            std::cout << " log " << path;
+        }
+        std::cout << "\n";
+    }
+
+    std::cout << "trials: " << opt.fuzz << "\n";
+    std::cout << "edges: " << fuzzer.edge_count() << "\n";
+    std::cout << "corpus: " << fuzzer.corpus_size() << "\n";
+    std::cout << "faults: " << events.size() << "\n";
+    std::cout << "trials/s: " << uint64_t(opt.fuzz / elapsed.count()) << std::endl;
+    return 0;
+}
+
+// Run many seeded copies of a rom across every core and report each one
+static int run_batch(const Options& opt) {
+    Batch batch(0, opt.engine, opt.ipf);
+    std::unique_ptr<Aot> aot = load_aot(opt, VIP);
+    batch.attach(aot.get());
+    std::vector<uint8_t> data = Batch::load(opt.rom);
+    for (unsigned i = 0; i < opt.batch; i++) {
+        batch.add(data, i);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<Batch::Result> results = batch.run(opt.cycles);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    uint64_t executed = 0;
+    for (size_t i = 0; i < results.size(); i++) {
+        std::cout << i << ": hash 0x" << std::hex << results[i].hash << " pc 0x" << results[i].regs.pc;
+        std::cout << std::dec << " cycles " << results[i].cycles << "\n";
+        executed += results[i].cycles;
+    }
+    std::cout << "ips: " << uint64_t(executed / elapsed.count()) << std::endl;
+    return 0;
+}
+
+// Run LANES seeded copies of a rom in one structure-of-arrays engine
+template <int LANES>
+static int run_lockstep(const Options& opt) {
+    // faults from every lane go to stderr
+    Headless host;
+    std::unique_ptr<Lockstep<LANES>> engine(new Lockstep<LANES>(host, Batch::load(opt.rom), opt.ipf));
+    for (int i = 0; i < LANES; i++) {
+        engine->seed(i, i);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    engine->run(opt.cycles);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    for (int i = 0; i < LANES; i++) {
+        std::cout << i << ": hash 0x" << std::hex << engine->framebuffer(i).hash() << " pc 0x" << engine->registers(i).pc;
+        std::cout << std::dec << "\n";
+    }
+    std::cout << "vector: " << engine->vector_count << " lane: " << engine->lane_count << "\n";
+    std::cout << "ips: " << uint64_t(opt.cycles * LANES / elapsed.count()) << std::endl;
+    return 0;
+}
+
+// Core thread of the windowed mode: runs the machine at 60hz against the
+// relay and keeps the rewind history, never touching SDL
+static void emulate(Chip8& chip, Relay& relay, Profiler* profiler, const Options& opt) {
+    // one saved state per frame for the rewind hotkey
+    Rewind history;
+    State state;
+
+    // 60hz, the only place the wall clock is read
+    const std::chrono::microseconds frame_time(16667);
+    auto next_frame = std::chrono::steady_clock::now();
+
+    while (!relay.is_stopped()) {
+        if (relay.rewinding) {
+            // step back one frame per frame while the key is held
+            if (history.pop(state)) {
+                chip.restore(state);
+                relay.render(chip.framebuffer());
+            }
+        } else {
+            chip.snapshot(state);
+            history.push(state);
+
+            // run
+            if (profiler != nullptr) {
+                profiler->start();
+                chip.run_frame(opt.engine, *profiler);
+                profiler->stop();
+            } else {
+                chip.run_frame(opt.engine);
+            }
+        }
+
+        // sleep off the rest of the frame, don't try to catch up after a stall
+        next_frame += frame_time;
+        auto now = std::chrono::steady_clock::now();
+        if (now > next_frame + frame_time) {
+            next_frame = now;
+        }
+        std::this_thread::sleep_until(next_frame);
+    }
+}
 
 int main(int argc, char* argv[]) {
+    Options opt;
+
     // Setup arguments and usage
-    if (argc != 2) {
-        std::cout << "Usage: please supply rom <filename>" << std::endl;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--headless") == 0) {
+            opt.headless = true;
+        } else if (strcmp(argv[i], "--cached") == 0) {
+            opt.engine = Chip8::CACHED;
+        } else if (strcmp(argv[i], "--threaded") == 0) {
+            opt.engine = Chip8::THREADED;
+        } else if (strcmp(argv[i], "--jit") == 0) {
+            opt.engine = Chip8::JIT;
+        } else if (strcmp(argv[i], "--aot") == 0 && i + 1 < argc) {
+            opt.engine = Chip8::AOT;
+            opt.aot = argv[++i];
+        } else if (strcmp(argv[i], "--no-idle") == 0) {
+            opt.idle = false;
+        } else if (strcmp(argv[i], "--skip-cycles") == 0) {
+            opt.cycle_skip = true;
+        } else if (strcmp(argv[i], "--analyze") == 0) {
+            opt.analyze = true;
+        } else if (strcmp(argv[i], "--diff") == 0) {
+            opt.diff = true;
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            opt.batch = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--fuzz") == 0 && i + 1 < argc) {
+            opt.fuzz = strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--lockstep") == 0 && i + 1 < argc) {
+            opt.lanes = strtoul(argv[++i], nullptr, 10);
+            if (opt.lanes != 8 && opt.lanes != 16 && opt.lanes != 32) {
+                opt.rom = nullptr;
+                break;
+            }
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            opt.record = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            opt.replay = argv[++i];
+        } else if (strcmp(argv[i], "--keys") == 0 && i + 1 < argc) {
+            opt.keys = argv[++i];
+        } else if (strcmp(argv[i], "--platform") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "schip") == 0) {
+                opt.platform = SUPER_CHIP;
+            } else if (strcmp(argv[i], "modern") == 0) {
+                opt.platform = MODERN;
+            } else {
+                opt.platform = VIP;
+            }
+        } else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+            opt.profile = argv[++i];
+        } else if (strcmp(argv[i], "--cycles") == 0 && i + 1 < argc) {
+            opt.cycles = strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--ipf") == 0 && i + 1 < argc) {
+            opt.ipf = atoi(argv[++i]);
+        } else if (opt.rom == nullptr) {
+            opt.rom = argv[i];
+        } else {
+            opt.rom = nullptr;
+            break;
+        }
+    }
+
+    if (opt.rom == nullptr) {
+        std::cout << "Usage: please supply rom [--headless] [--cycles N] [--ipf N] [--cached | --threaded | --jit | --aot DIR] [--no-idle] [--skip-cycles] [--platform vip|schip|modern] [--keys LAYOUT] [--record LOG | --replay LOG] [--profile PREFIX] [--analyze] [--diff] [--batch N] [--lockstep 8|16|32] [--fuzz TRIALS] <filename>" << std::endl;
         return 1;
     }
 
+    if (opt.analyze) {
+        Analysis(Batch::load(opt.rom)).print(std::cout);
+        return 0;
+    }
+
+    if (opt.diff) {
+        return run_diff(opt);
+    }
+
+    if (opt.replay) {
+        return run_replay(opt);
+    }
+
+    if (opt.fuzz > 0) {
+        return run_fuzz(opt);
+    }
+
+    switch (opt.lanes) {
+    case 8: return run_lockstep<8>(opt);
+    case 16: return run_lockstep<16>(opt);
+    case 32: return run_lockstep<32>(opt);
+    }
+
+    if (opt.batch > 0) {
+        return run_batch(opt);
+    }
+
+    // the recompilers and the threaded loop run many instructions per call,
+    // profile through the cache instead
+    if (opt.profile && (opt.engine == Chip8::JIT || opt.engine == Chip8::THREADED || opt.engine == Chip8::AOT)) {
+        opt.engine = Chip8::CACHED;
+    }
+
+    if (opt.headless) {
+        return run_headless(opt);
+    }
+
     // Window (Wrapper around SDL)
     Window win = Window();
-    uint64_t time_start = SDL_GetTicks64();
-    Chip8 chip(win, time_start, argv[1]);
+    if (opt.keys && !win.set_layout(opt.keys)) {
+        std::cerr << "Error: --keys needs 16 distinct letters or digits, for keys 0 through F\n";
+        return 1;
+    }
+
+    // a published frame wakes the event wait below, beeper edges go
+    // straight to the audio callback
+    Audio audio(opt.ipf);
+    Relay relay;
+    relay.on_frame = [&win] { win.wake(); };
+    relay.on_beep = [&audio](bool on, uint64_t cycle) { audio.push(on, cycle); };
 
+    // recording latches keys per frame between the core and the relay
+    InputLog log;
+    Recorder recorder(relay, log);
+    Host& inner = opt.record ? static_cast<Host&>(recorder) : relay;
+    Profiler profiler(inner);
+    Chip8 chip(opt.profile ? static_cast<Host&>(profiler) : inner, opt.rom);
+    chip.set_ipf(opt.ipf);
+    chip.set_idle_skip(opt.idle);
+    chip.set_platform(opt.platform);
+    if (opt.record) {
+        begin_log(log, chip, opt);
+    }
+    std::unique_ptr<Aot> aot = open_aot(chip, opt, opt.platform);
+    warm(chip, opt);
+
+    std::thread core(emulate, std::ref(chip), std::ref(relay), opt.profile ? &profiler : nullptr, std::cref(opt));
+
+    // this thread only talks to SDL: events in, frames out
+    Framebuffer shown;
+    const std::chrono::microseconds frame_time(16667);
+    auto next_tick = std::chrono::steady_clock::now();
     while (win.running) {
-        // Poll Events
-        win.poll();
+        // sleep until input, a new frame or the next 60hz tick at the latest
+        auto now = std::chrono::steady_clock::now();
+        while (next_tick <= now) {
+            next_tick += frame_time;
+        }
+        win.wait(std::chrono::duration_cast<std::chrono::milliseconds>(next_tick - now).count() + 1);
+
+        // keys go straight to the core, it sees them on its next frame
+        relay.set_keys(win.key_mask());
 
-        // run
-        chip.run();
+        // a recording is one timeline, rewinding would fork it
+        relay.rewinding = win.rewinding && !opt.record;
 
-        // run at 500 khz
-        while (SDL_GetTicks64() - time_start <= 1) {}
+        // present the newest frame, render() skips it if nothing changed
+        relay.fetch(shown);
+        win.render(shown);
+        shown.dirty = 0;
     }
 
+    relay.stop();
+    core.join();
+
+    if (opt.profile) {
+        write_profile(profiler, opt.profile);
+    }
+    if (opt.record) {
+        log.save(opt.record);
+    }
     return 0;
 }